@@ -55,9 +55,13 @@ int xradio_sta_add(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 #ifdef AP_AGGREGATE_FW_FIX
 	struct xradio_common *hw_priv = hw->priv;
 #endif
+	int i;
 
 	ap_printk(XRADIO_DBG_TRC,"%s\n", __FUNCTION__);
 
+	for (i = 0; i < ARRAY_SIZE(sta->txq); i++)
+		xradio_txq_init(sta->txq[i]);
+
 #ifdef P2P_MULTIVIF
 	SYS_WARN(priv->if_id == XRWL_GENERIC_IF_ID);
 #endif
@@ -73,6 +77,7 @@ int xradio_sta_add(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 		ap_printk(XRADIO_DBG_ERROR,"No more link IDs available.\n");
 		return -ENOENT;
 	}
+	xradio_airtime_reset(hw->priv, priv->if_id, sta_priv->link_id);
 
 	entry = &priv->link_id_db[sta_priv->link_id - 1];
 	spin_lock_bh(&priv->ps_state_lock);
@@ -94,6 +99,7 @@ int xradio_sta_add(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 					XRADIO_RX_BLOCK_ACK_DISABLED_FOR_ALL_TID,
 					priv->if_id));
 			wsm_unlock_tx(hw_priv);
+			xradio_ba_reset(priv, -1);
 	}
 #endif
 
@@ -108,9 +114,13 @@ int xradio_sta_remove(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 			(struct xradio_sta_priv *)&sta->drv_priv;
 	struct xradio_vif *priv = xrwl_get_vif_from_ieee80211(vif);
 	struct xradio_link_entry *entry;
+	int i;
 
 	ap_printk(XRADIO_DBG_TRC,"%s\n", __FUNCTION__);
 
+	for (i = 0; i < ARRAY_SIZE(sta->txq); i++)
+		xradio_txq_unlink(hw_priv, sta->txq[i]);
+
 #ifdef P2P_MULTIVIF
 	SYS_WARN(priv->if_id == XRWL_GENERIC_IF_ID);
 #endif
@@ -129,18 +139,21 @@ int xradio_sta_remove(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 		wsm_unlock_tx(hw_priv);
 	spin_unlock_bh(&priv->ps_state_lock);
 	flush_workqueue(hw_priv->workqueue);
+	xradio_ba_reset(priv, sta_priv->link_id);
 
 #ifdef AP_AGGREGATE_FW_FIX
 	hw_priv->connected_sta_cnt--;
 	if(hw_priv->connected_sta_cnt <= 1) {
 		if ((priv->if_id != 1) ||
 			((priv->if_id == 1) && hw_priv->is_go_thru_go_neg)) {
+			/* TX block ack follows the traffic again. */
 			wsm_lock_tx(hw_priv);
 			SYS_WARN(wsm_set_block_ack_policy(hw_priv,
-						XRADIO_TX_BLOCK_ACK_ENABLED_FOR_ALL_TID,
+						XRADIO_TX_BLOCK_ACK_DISABLED_FOR_ALL_TID,
 						XRADIO_RX_BLOCK_ACK_ENABLED_FOR_ALL_TID,
 						priv->if_id));
 			wsm_unlock_tx(hw_priv);
+			xradio_ba_reset(priv, -1);
 		}
 	}
 #endif
@@ -612,9 +625,6 @@ void xradio_bss_info_changed(struct ieee80211_hw *dev,
 	     BSS_CHANGED_ERP_PREAMBLE |
 	     BSS_CHANGED_HT           |
 	     BSS_CHANGED_ERP_SLOT)) {
-		int is_combo = 0;
-		int i;
-		struct xradio_vif *tmp_priv;
 		ap_printk(XRADIO_DBG_NIY, "BSS_CHANGED_ASSOC.\n");
 		if (info->assoc) { /* TODO: ibss_joined */
 			struct ieee80211_sta *sta = NULL;
@@ -644,33 +654,6 @@ void xradio_bss_info_changed(struct ieee80211_hw *dev,
 			}
 			rcu_read_unlock();
 			priv->htcap = (sta && xradio_is_ht(&hw_priv->ht_oper));
-			xradio_for_each_vif(hw_priv, tmp_priv, i) {
-#ifdef P2P_MULTIVIF
-				if ((i == (XRWL_MAX_VIFS - 1)) || !tmp_priv)
-#else
-				if (!tmp_priv)
-#endif
-					continue;
-				if (tmp_priv->join_status >= XRADIO_JOIN_STATUS_STA)
-					is_combo++;
-			}
-
-			if (is_combo > 1) {
-				hw_priv->vif0_throttle = XRWL_HOST_VIF0_11BG_THROTTLE;
-				hw_priv->vif1_throttle = XRWL_HOST_VIF1_11BG_THROTTLE;
-				ap_printk(XRADIO_DBG_WARN, "%sASSOC is_combo %d\n", 
-				         (priv->join_status == XRADIO_JOIN_STATUS_STA)?"[STA] ":"",
-				          hw_priv->vif0_throttle);
-			} else if ((priv->join_status == XRADIO_JOIN_STATUS_STA) && priv->htcap) {
-				hw_priv->vif0_throttle = XRWL_HOST_VIF0_11N_THROTTLE;
-				hw_priv->vif1_throttle = XRWL_HOST_VIF1_11N_THROTTLE;
-				ap_printk(XRADIO_DBG_WARN, "[STA] ASSOC HTCAP 11N %d\n",hw_priv->vif0_throttle);
-			} else {
-				hw_priv->vif0_throttle = XRWL_HOST_VIF0_11BG_THROTTLE;
-				hw_priv->vif1_throttle = XRWL_HOST_VIF1_11BG_THROTTLE;
-				ap_printk(XRADIO_DBG_WARN, "ASSOC not_combo 11BG %d\n",hw_priv->vif0_throttle);
-			}
-
 			if (sta) {
 				__le32 val = 0;
 				if (hw_priv->ht_oper.operation_mode & IEEE80211_HT_OP_MODE_NON_GF_STA_PRSNT) {
@@ -748,10 +731,12 @@ void xradio_bss_info_changed(struct ieee80211_hw *dev,
 #endif
 			if (priv->htcap) {
 				wsm_lock_tx(hw_priv);
-				/* Statically enabling block ack for TX/RX */
-				SYS_WARN(wsm_set_block_ack_policy(hw_priv, hw_priv->ba_tid_mask, 
+				/* Block ack for RX; TX follows the traffic,
+				 * see xradio_ba_timer(). */
+				SYS_WARN(wsm_set_block_ack_policy(hw_priv, 0,
 				                                  hw_priv->ba_tid_mask, priv->if_id));
 				wsm_unlock_tx(hw_priv);
+				xradio_ba_reset(priv, -1);
 			}
 			/*set ps active,avoid that when connecting process,the device sleeps,then can't receive pkts.*/
 			if (changed & BSS_CHANGED_ASSOC) 
@@ -926,6 +911,7 @@ void xradio_bss_info_changed(struct ieee80211_hw *dev,
 		  (info->retry_short < 0x0F ? info->retry_short : 0x0F);
 		hw_priv->hw->max_rate_tries = hw_priv->short_frame_max_tx_count;
 		spin_unlock_bh(&hw_priv->tx_policy_cache.lock);
+		xradio_tx_desc_flush(hw_priv);
 		/* TBD: I think we don't need tx_policy_force_upload().
 		 * Outdated policies will leave cache in a normal way. */
 		/* SYS_WARN(tx_policy_force_upload(priv)); */
@@ -1486,23 +1472,16 @@ static int xradio_start_ap(struct xradio_vif *priv)
 		         XRADIO_TX_BLOCK_ACK_DISABLED_FOR_ALL_TID,
 		         XRADIO_RX_BLOCK_ACK_DISABLED_FOR_ALL_TID, priv->if_id));
 #else
-		if ((priv->if_id ==1) && !hw_priv->is_go_thru_go_neg)
-			SYS_WARN(wsm_set_block_ack_policy(hw_priv,
-			         XRADIO_TX_BLOCK_ACK_ENABLED_FOR_ALL_TID, //modified for WFD by yangfh
-			         XRADIO_RX_BLOCK_ACK_ENABLED_FOR_ALL_TID, priv->if_id));
-		else
-			SYS_WARN(wsm_set_block_ack_policy(hw_priv,
-			         XRADIO_TX_BLOCK_ACK_ENABLED_FOR_ALL_TID,
-			         XRADIO_RX_BLOCK_ACK_ENABLED_FOR_ALL_TID, priv->if_id));
+		/* TX block ack follows the traffic, see xradio_ba_timer(). */
+		SYS_WARN(wsm_set_block_ack_policy(hw_priv,
+		         XRADIO_TX_BLOCK_ACK_DISABLED_FOR_ALL_TID,
+		         XRADIO_RX_BLOCK_ACK_ENABLED_FOR_ALL_TID, priv->if_id));
+		xradio_ba_reset(priv, -1);
 #endif
 		priv->join_status = XRADIO_JOIN_STATUS_AP;
 		/* xradio_update_filtering(priv); */
 	}
 	SYS_WARN(wsm_set_operational_mode(hw_priv, &mode, priv->if_id));
-	hw_priv->vif0_throttle = XRWL_HOST_VIF0_11BG_THROTTLE;
-	hw_priv->vif1_throttle = XRWL_HOST_VIF1_11BG_THROTTLE;
-	ap_printk(XRADIO_DBG_WARN, "vif%d, AP/GO mode THROTTLE=%d\n", priv->if_id,
-	          priv->if_id==0?hw_priv->vif0_throttle:hw_priv->vif1_throttle);
 	return ret;
 }
 
@@ -1563,7 +1542,8 @@ int xradio_alloc_link_id(struct xradio_vif *priv, const u8 *mac)
 			ret = i + 1;
 			break;
 		} else if (priv->link_id_db[i].status != XRADIO_LINK_HARD &&
-		           !hw_priv->tx_queue_stats.link_map_cache[i + 1]) {
+		           !(hw_priv->tx_queue_stats.link_map[priv->if_id] &
+		             BIT(i + 1))) {
 			unsigned long inactivity = now - priv->link_id_db[i].timestamp;
 			if (inactivity < max_inactivity)
 				continue;
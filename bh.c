@@ -483,6 +483,7 @@ static int xradio_bh(void *arg)
 	int pending_tx = 0;
 	int tx_burst;
 	int rx_burst = 0;
+	int rx_cnt = 0;
 	long status;
 	u32 dummy;
 	int vif_selected;
@@ -658,6 +659,7 @@ rx:
 			read_len = (ctrl_reg & HIF_CTRL_NEXT_LEN_MASK)<<1; //read_len=ctrl_reg*2.
 			if (!read_len) {
 				rx_burst = 0;
+				rx_cnt = 0;
 				goto tx;
 			}
 			if (SYS_WARN((read_len < sizeof(struct wsm_hdr)) ||
@@ -784,6 +786,19 @@ rx:
 			}
 			read_len = 0;
 
+			/* Command priority: a queued command doesn't wait
+			 * until the RX side is drained. It may have been
+			 * queued after bh_tx was read, so send in any case. */
+			if (hw_priv->cmd_prio_enable && hw_priv->wsm_cmd.ptr &&
+			    ++rx_cnt >= hw_priv->cmd_prio_rx_burst) {
+				xradio_debug_cmd_prio_rx_cut(hw_priv);
+				atomic_xchg(&hw_priv->bh_tx, 0);
+				tx = 1;
+				rx_cnt = 0;
+				rx_burst = 0;
+				goto tx;
+			}
+
 			/* Check if rx burst */
 			if (rx_burst) {
 				xradio_debug_rx_burst(hw_priv);
@@ -897,6 +912,7 @@ tx:
 				}
 				wsm_txed(hw_priv, data);
 				hw_priv->wsm_tx_seq = (hw_priv->wsm_tx_seq + 1) & WSM_TX_SEQ_MAX;
+				rx_cnt = 0;
 
 				/* Check for burst. */
 				if (tx_burst > 1) {
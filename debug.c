@@ -20,6 +20,7 @@
 
 #include "xradio.h"
 #include "hwio.h"
+#include "sta.h"
 #include "debug.h"
 
 /*added by yangfh, for host debuglevel*/
@@ -101,6 +102,13 @@ static void xradio_queue_status_show(struct seq_file *seq,
 	seq_printf(seq, "  sent:     %d\n", q->num_sent);
 	seq_printf(seq, "  locked:   %s\n", q->tx_locked_cnt ? "yes" : "no");
 	seq_printf(seq, "  overfull: %s\n", q->overfull ? "yes" : "no");
+	seq_printf(seq, "  fq drops: %zu\n", q->num_fq_drops);
+	seq_printf(seq, "  expired:  %zu\n", q->num_expired);
+	seq_printf(seq, "  acks:     %zu filtered\n", q->num_ack_drops);
+	for (if_id = 0; if_id < XRWL_MAX_VIFS; if_id++)
+		seq_printf(seq, "  vif%d:     %zu/%zu bytes%s\n", if_id,
+			   q->bytes_queued_vif[if_id], q->bql_limit[if_id],
+			   (q->hw_stopped & BIT(if_id)) ? ", stopped" : "");
 	seq_puts(seq,   "  link map: 0-> ");
 	for (if_id = 0; if_id < XRWL_MAX_VIFS; if_id++) {
 		for (i = 0; i < q->stats->map_capacity; ++i)
@@ -1258,6 +1266,7 @@ static ssize_t xradio_retry_set(struct file *file,
 		          hw_priv->long_frame_max_tx_count);
 	}
 	retry_dbg |= 0x2;
+	xradio_tx_desc_flush(hw_priv);
 	return count;
 }
 
@@ -1895,6 +1904,755 @@ static const struct file_operations fops_bh_stat = {
 	.llseek = default_llseek,
 };
 
+/* WSM command latency, called from wsm_cmd_send with wsm_cmd_mux held. */
+void xradio_debug_wsm_cmd(struct xradio_common *hw_priv, u16 cmd, u16 mib,
+                          s64 lat_us, int rx_ext_loops, bool timeout)
+{
+	struct xradio_debug_common *d = hw_priv->debug;
+	struct xradio_cmd_lat *lat = NULL;
+	u32 us;
+	int i, bucket;
+
+	if (!d)
+		return;
+
+	if (cmd != 0x0005 && cmd != 0x0006)
+		mib = 0;
+	for (i = 0; i < d->cmd_lat_num; i++) {
+		if (d->cmd_lat[i].cmd == cmd && d->cmd_lat[i].mib == mib) {
+			lat = &d->cmd_lat[i];
+			break;
+		}
+	}
+	if (!lat) {
+		if (d->cmd_lat_num >= XRADIO_CMD_LAT_SLOTS)
+			return;
+		lat = &d->cmd_lat[d->cmd_lat_num];
+		lat->cmd = cmd;
+		lat->mib = mib;
+		d->cmd_lat_num++;
+	}
+
+	us = (lat_us > 0) ? (u32)min_t(s64, lat_us, U32_MAX) : 0;
+	bucket = xradio_debug_lat_bucket(us);
+
+	lat->count++;
+	lat->hist[bucket]++;
+	lat->total_us += us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+	if (rx_ext_loops > 0) {
+		lat->rx_extended++;
+		lat->rx_ext_loops += rx_ext_loops;
+	}
+	if (timeout)
+		lat->timeout++;
+}
+
+static int xradio_cmd_latency_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_debug_common *d = hw_priv->debug;
+	int i, j;
+
+	seq_puts(seq, "Latency buckets are log2(us): [2^n, 2^(n+1)).\n");
+	for (i = 0; i < d->cmd_lat_num; i++) {
+		struct xradio_cmd_lat *lat = &d->cmd_lat[i];
+
+		if (!lat->count)
+			continue;
+		if (lat->cmd == 0x0005 || lat->cmd == 0x0006)
+			seq_printf(seq, "0x%.4X [MIB: 0x%.4X]:", lat->cmd, lat->mib);
+		else
+			seq_printf(seq, "0x%.4X:              ", lat->cmd);
+		seq_printf(seq, " count=%u, avg=%lluus, max=%uus, "
+		           "rx_extended=%u(%u waits), timeout=%u\n",
+		           lat->count, div_u64(lat->total_us, lat->count),
+		           lat->max_us, lat->rx_extended, lat->rx_ext_loops,
+		           lat->timeout);
+		for (j = 0; j < XRADIO_CMD_LAT_BUCKETS; j++) {
+			if (lat->hist[j])
+				seq_printf(seq, "    %8luus: %u\n", 1UL << j,
+				           lat->hist[j]);
+		}
+	}
+	return 0;
+}
+
+static int xradio_cmd_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_cmd_latency_show,
+		inode->i_private);
+}
+
+/* Writing anything clears the histograms. */
+static ssize_t xradio_cmd_latency_clear(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	struct xradio_debug_common *d = hw_priv->debug;
+
+	mutex_lock(&hw_priv->wsm_cmd_mux);
+	d->cmd_lat_num = 0;
+	memset(d->cmd_lat, 0, sizeof(d->cmd_lat));
+	mutex_unlock(&hw_priv->wsm_cmd_mux);
+	return count;
+}
+
+static const struct file_operations fops_cmd_latency = {
+	.open    = xradio_cmd_latency_open,
+	.read    = seq_read,
+	.write   = xradio_cmd_latency_clear,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_cmd_prio_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_debug_common *d = hw_priv->debug;
+	int i;
+
+	seq_printf(seq, "enable=%d, rx_burst=%d, tx_bufs=%d\n",
+	           hw_priv->cmd_prio_enable, hw_priv->cmd_prio_rx_burst,
+	           hw_priv->cmd_prio_tx_bufs);
+	seq_printf(seq, "rx_cut=%u, tx_held=%u, txed_max=%uus\n",
+	           d->cmd_prio_rx_cut, d->cmd_prio_tx_held,
+	           d->cmd_txed_max_us);
+	seq_puts(seq, "submit-to-bus delay:\n");
+	for (i = 0; i < XRADIO_CMD_LAT_BUCKETS; i++) {
+		if (d->cmd_txed_hist[i])
+			seq_printf(seq, "    %8luus: %u\n", 1UL << i,
+			           d->cmd_txed_hist[i]);
+	}
+	return 0;
+}
+
+static int xradio_cmd_prio_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_cmd_prio_show,
+		inode->i_private);
+}
+
+/* "<enable> <rx_burst> <tx_bufs>", also clears the statistics. */
+static ssize_t xradio_cmd_prio_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	struct xradio_debug_common *d = hw_priv->debug;
+	char buf[20] = {0};
+	char *start  = &buf[0];
+	char *endptr = NULL;
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	hw_priv->cmd_prio_enable = !!simple_strtoul(start, &endptr, 10);
+	start = endptr + 1;
+	if (start < buf + count)
+		hw_priv->cmd_prio_rx_burst =
+			clamp_t(ulong, simple_strtoul(start, &endptr, 10), 1, 255);
+	start = endptr + 1;
+	if (start < buf + count)
+		hw_priv->cmd_prio_tx_bufs =
+			clamp_t(ulong, simple_strtoul(start, &endptr, 10), 1, 255);
+
+	d->cmd_prio_rx_cut  = 0;
+	d->cmd_prio_tx_held = 0;
+	d->cmd_txed_max_us  = 0;
+	memset(d->cmd_txed_hist, 0, sizeof(d->cmd_txed_hist));
+
+	xradio_dbg(XRADIO_DBG_ALWY, "cmd_prio enable=%d, rx_burst=%d, tx_bufs=%d\n",
+	           hw_priv->cmd_prio_enable, hw_priv->cmd_prio_rx_burst,
+	           hw_priv->cmd_prio_tx_bufs);
+	return count;
+}
+
+static const struct file_operations fops_cmd_prio = {
+	.open    = xradio_cmd_prio_open,
+	.read    = seq_read,
+	.write   = xradio_cmd_prio_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_fq_codel_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	int i;
+
+	seq_printf(seq, "enable=%d, target=%ums, interval=%ums\n",
+	           hw_priv->fq_codel_enable,
+	           jiffies_to_msecs(hw_priv->fq_codel_target),
+	           jiffies_to_msecs(hw_priv->fq_codel_interval));
+	for (i = 0; i < AC_QUEUE_NUM; i++)
+		seq_printf(seq, "queue %d: drops=%zu\n", i,
+		           hw_priv->tx_queue[i].num_fq_drops);
+	return 0;
+}
+
+static int xradio_fq_codel_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_fq_codel_show,
+		inode->i_private);
+}
+
+/* "<enable> <target_ms> <interval_ms>" */
+static ssize_t xradio_fq_codel_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	char buf[20] = {0};
+	char *start  = &buf[0];
+	char *endptr = NULL;
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	hw_priv->fq_codel_enable = !!simple_strtoul(start, &endptr, 10);
+	start = endptr + 1;
+	if (start < buf + count)
+		hw_priv->fq_codel_target = max_t(ulong, 1,
+			msecs_to_jiffies(simple_strtoul(start, &endptr, 10)));
+	start = endptr + 1;
+	if (start < buf + count)
+		hw_priv->fq_codel_interval = max_t(ulong, 1,
+			msecs_to_jiffies(simple_strtoul(start, &endptr, 10)));
+
+	xradio_dbg(XRADIO_DBG_ALWY, "fq_codel enable=%d, target=%ums, interval=%ums\n",
+	           hw_priv->fq_codel_enable,
+	           jiffies_to_msecs(hw_priv->fq_codel_target),
+	           jiffies_to_msecs(hw_priv->fq_codel_interval));
+	return count;
+}
+
+static int xradio_vif_sched_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	int i;
+
+	seq_printf(seq, "fw bufs: %d/%d, serving vif %d\n",
+	           hw_priv->hw_bufs_used, hw_priv->wsm_caps.numInpChBufs,
+	           hw_priv->if_id_selected);
+	for (i = 0; i < XRWL_MAX_VIFS; i++)
+		seq_printf(seq, "vif %d: %s weight=%u, deficit=%d, bufs=%d\n",
+		           i, hw_priv->vif_list[i] ? "up  " : "down",
+		           hw_priv->vif_weight[i], hw_priv->vif_deficit[i],
+		           hw_priv->hw_bufs_used_vif[i]);
+	return 0;
+}
+
+static int xradio_vif_sched_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_vif_sched_show,
+		inode->i_private);
+}
+
+/* "<weight0> <weight1> ..." */
+static ssize_t xradio_vif_sched_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	char buf[20] = {0};
+	char *start  = &buf[0];
+	char *endptr = NULL;
+	int i;
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	for (i = 0; i < XRWL_MAX_VIFS && start < buf + count; i++) {
+		hw_priv->vif_weight[i] = clamp_t(ulong,
+			simple_strtoul(start, &endptr, 10),
+			1, XRADIO_VIF_WEIGHT_MAX);
+		start = endptr + 1;
+	}
+
+	xradio_dbg(XRADIO_DBG_ALWY, "vif_sched weights=%u %u\n",
+	           hw_priv->vif_weight[0], hw_priv->vif_weight[1]);
+	return count;
+}
+
+static const struct file_operations fops_vif_sched = {
+	.open    = xradio_vif_sched_open,
+	.read    = seq_read,
+	.write   = xradio_vif_sched_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_fast_lane_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	int i;
+
+	seq_printf(seq, "mask=0x%02x (mgmt=0x%x, eapol=0x%x, dhcp=0x%x, "
+	           "voice=0x%x)\n", hw_priv->fast_lane_mask,
+	           XRADIO_FAST_LANE_MGMT, XRADIO_FAST_LANE_EAPOL,
+	           XRADIO_FAST_LANE_DHCP, XRADIO_FAST_LANE_VOICE);
+	for (i = 0; i < AC_QUEUE_NUM; i++)
+		seq_printf(seq, "queue %d: queued=%zu\n", i,
+		           hw_priv->tx_queue[i].num_fast);
+	return 0;
+}
+
+static int xradio_fast_lane_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_fast_lane_show,
+		inode->i_private);
+}
+
+/* "<mask>" */
+static ssize_t xradio_fast_lane_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	char buf[20] = {0};
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	hw_priv->fast_lane_mask = simple_strtoul(buf, NULL, 0) &
+		XRADIO_FAST_LANE_DEFAULT;
+
+	xradio_dbg(XRADIO_DBG_ALWY, "fast_lane mask=0x%02x\n",
+	           hw_priv->fast_lane_mask);
+	return count;
+}
+
+static const struct file_operations fops_fast_lane = {
+	.open    = xradio_fast_lane_open,
+	.read    = seq_read,
+	.write   = xradio_fast_lane_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_amsdu_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_debug_common *d = hw_priv->debug;
+
+	seq_printf(seq, "enable=%d, max_subframes=%d, buf_size=%d\n",
+	           hw_priv->amsdu_enable, XRADIO_AMSDU_MAX_SUBFRAMES,
+	           hw_priv->wsm_caps.sizeInpChBuf);
+	seq_printf(seq, "A-MSDUs: %d (%d subframes)\n",
+	           d->tx_amsdu, d->tx_amsdu_subframes);
+	return 0;
+}
+
+static int xradio_amsdu_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_amsdu_show,
+		inode->i_private);
+}
+
+/* "<0|1>" */
+static ssize_t xradio_amsdu_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	char buf[20] = {0};
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	hw_priv->amsdu_enable = !!simple_strtoul(buf, NULL, 10);
+
+	xradio_dbg(XRADIO_DBG_ALWY, "amsdu %s\n",
+	           hw_priv->amsdu_enable ? "on" : "off");
+	return count;
+}
+
+static const struct file_operations fops_amsdu = {
+	.open    = xradio_amsdu_open,
+	.read    = seq_read,
+	.write   = xradio_amsdu_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_block_ack_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_vif *priv;
+	struct xradio_ba_tid *ba;
+	int i, link_id, tid;
+
+	seq_printf(seq, "tid_mask=0x%02x\n", hw_priv->ba_tid_mask);
+	seq_puts(seq, "if link tid active idle fails backoff   agg/done\n");
+	spin_lock_bh(&hw_priv->ba_lock);
+	xradio_for_each_vif(hw_priv, priv, i) {
+		if (!priv)
+			continue;
+		for (link_id = 0; link_id <= MAX_STA_IN_AP_MODE; link_id++) {
+			for (tid = 0; tid < XRADIO_MAX_TID; tid++) {
+				ba = &priv->ba_tid[link_id][tid];
+				if (!ba->active && !ba->total_done)
+					continue;
+				seq_printf(seq, "%2d %4d %3d %6d %4d %5d %7d %5u/%u\n",
+				           priv->if_id, link_id, tid, ba->active,
+				           ba->idle, ba->fails, ba->backoff,
+				           ba->total_agg, ba->total_done);
+			}
+		}
+		seq_printf(seq, "if%d: tx_mask=0x%02x, fw_mask=0x%02x\n",
+		           priv->if_id, priv->ba_tx_mask, priv->ba_fw_mask);
+	}
+	spin_unlock_bh(&hw_priv->ba_lock);
+	return 0;
+}
+
+static int xradio_block_ack_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_block_ack_show,
+		inode->i_private);
+}
+
+static const struct file_operations fops_block_ack = {
+	.open    = xradio_block_ack_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_rts_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_vif *priv;
+	struct xradio_rts *rts;
+	int i;
+
+	seq_printf(seq, "auto=%d, threshold=%u, dyn_threshold=%d\n",
+	           hw_priv->rts_auto, hw_priv->rts_threshold,
+	           XRADIO_RTS_THRESHOLD);
+	seq_puts(seq, "if rts threshold fail%% switches  kbps_on kbps_off\n");
+	xradio_for_each_vif(hw_priv, priv, i) {
+		if (!priv)
+			continue;
+		rts = &priv->rts;
+		seq_printf(seq, "%2d %3s %9u %5u %8u %8llu %8llu\n",
+		           priv->if_id, rts->enabled ? "on" : "off",
+		           rts->threshold, rts->fail_pct, rts->switches,
+		           rts->ms_on ? div_u64(rts->bytes_on * 8, rts->ms_on) : 0,
+		           rts->ms_off ? div_u64(rts->bytes_off * 8, rts->ms_off) : 0);
+	}
+	return 0;
+}
+
+static int xradio_rts_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_rts_show,
+		inode->i_private);
+}
+
+/* "<0|1>" */
+static ssize_t xradio_rts_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	struct xradio_vif *priv;
+	char buf[20] = {0};
+	int i;
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	mutex_lock(&hw_priv->conf_mutex);
+	hw_priv->rts_auto = !!simple_strtoul(buf, NULL, 10);
+	if (!hw_priv->rts_auto) {
+		xradio_for_each_vif(hw_priv, priv, i) {
+			if (!priv || !priv->rts.enabled)
+				continue;
+			priv->rts.enabled = false;
+			queue_work(hw_priv->workqueue, &priv->rts_work);
+		}
+	}
+	mutex_unlock(&hw_priv->conf_mutex);
+
+	xradio_dbg(XRADIO_DBG_ALWY, "dynamic rts %s\n",
+	           hw_priv->rts_auto ? "on" : "off");
+	return count;
+}
+
+static const struct file_operations fops_rts = {
+	.open    = xradio_rts_open,
+	.read    = seq_read,
+	.write   = xradio_rts_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_tx_lifetime_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_queue *queue;
+	int i, if_id, link_id;
+	u32 expired;
+
+	for (i = 0; i < AC_QUEUE_NUM; i++) {
+		queue = &hw_priv->tx_queue[i];
+		seq_printf(seq, "queue %d: lifetime=%ums, expired=%zu\n", i,
+		           jiffies_to_msecs(queue->lifetime), queue->num_expired);
+		for (if_id = 0; if_id < XRWL_MAX_VIFS; if_id++) {
+			for (link_id = 0; link_id < WLAN_LINK_ID_MAX; link_id++) {
+				expired = xradio_queue_expired(queue, if_id, link_id);
+				if (expired)
+					seq_printf(seq, "  if%d link %d: %u\n",
+					           if_id, link_id, expired);
+			}
+		}
+	}
+	return 0;
+}
+
+static int xradio_tx_lifetime_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_tx_lifetime_show,
+		inode->i_private);
+}
+
+/* "<queue> <ms>", 0 ms for no lifetime */
+static ssize_t xradio_tx_lifetime_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	struct xradio_vif *priv;
+	char buf[20] = {0};
+	char *endptr = NULL;
+	unsigned long queue_id, ms;
+	int i;
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	queue_id = simple_strtoul(buf, &endptr, 10);
+	if (queue_id >= AC_QUEUE_NUM || endptr + 1 >= buf + count)
+		return -EINVAL;
+	ms = simple_strtoul(endptr + 1, NULL, 10);
+
+	mutex_lock(&hw_priv->conf_mutex);
+	hw_priv->tx_queue[queue_id].lifetime = msecs_to_jiffies(ms);
+	xradio_for_each_vif(hw_priv, priv, i) {
+		if (priv && priv->join_status > XRADIO_JOIN_STATUS_MONITOR)
+			SYS_WARN(xradio_set_tx_lifetime(priv, queue_id));
+	}
+	mutex_unlock(&hw_priv->conf_mutex);
+
+	xradio_dbg(XRADIO_DBG_ALWY, "queue %lu lifetime=%lums\n",
+	           queue_id, ms);
+	return count;
+}
+
+static const struct file_operations fops_tx_lifetime = {
+	.open    = xradio_tx_lifetime_open,
+	.read    = seq_read,
+	.write   = xradio_tx_lifetime_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_ack_filter_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	int i;
+
+	seq_printf(seq, "enable=%d\n", hw_priv->tcp_ack_filter);
+	for (i = 0; i < AC_QUEUE_NUM; i++)
+		seq_printf(seq, "queue %d: filtered=%zu\n", i,
+		           hw_priv->tx_queue[i].num_ack_drops);
+	return 0;
+}
+
+static int xradio_ack_filter_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_ack_filter_show,
+		inode->i_private);
+}
+
+/* "<0|1>" */
+static ssize_t xradio_ack_filter_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	char buf[20] = {0};
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	hw_priv->tcp_ack_filter = !!simple_strtoul(buf, NULL, 10);
+
+	xradio_dbg(XRADIO_DBG_ALWY, "ack filter %s\n",
+	           hw_priv->tcp_ack_filter ? "on" : "off");
+	return count;
+}
+
+static const struct file_operations fops_ack_filter = {
+	.open    = xradio_ack_filter_open,
+	.read    = seq_read,
+	.write   = xradio_ack_filter_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_mc_to_uc_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_vif *priv;
+	int i;
+
+	mutex_lock(&hw_priv->conf_mutex);
+	xradio_for_each_vif(hw_priv, priv, i) {
+		if (!priv)
+			continue;
+		seq_printf(seq, "if%d: max_sta=%u, frames=%u, copies=%u\n",
+		           priv->if_id, priv->mc_to_uc,
+		           priv->mc_to_uc_frames, priv->mc_to_uc_copies);
+	}
+	mutex_unlock(&hw_priv->conf_mutex);
+	return 0;
+}
+
+static int xradio_mc_to_uc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_mc_to_uc_show,
+		inode->i_private);
+}
+
+/* "<if_id> <max_sta>", 0 stations for off */
+static ssize_t xradio_mc_to_uc_set(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct xradio_common *hw_priv =
+		((struct seq_file *)file->private_data)->private;
+	struct xradio_vif *priv;
+	char buf[20] = {0};
+	char *endptr = NULL;
+	unsigned long if_id, max_sta;
+	int i, ret = -ENOENT;
+
+	count = (count > 19 ? 19 : count);
+	if (!count)
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+
+	if_id = simple_strtoul(buf, &endptr, 10);
+	if (endptr + 1 >= buf + count)
+		return -EINVAL;
+	max_sta = simple_strtoul(endptr + 1, NULL, 10);
+
+	mutex_lock(&hw_priv->conf_mutex);
+	xradio_for_each_vif(hw_priv, priv, i) {
+		if (priv && priv->if_id == if_id) {
+			priv->mc_to_uc = min_t(unsigned long, max_sta,
+					       MAX_STA_IN_AP_MODE);
+			ret = count;
+		}
+	}
+	mutex_unlock(&hw_priv->conf_mutex);
+
+	xradio_dbg(XRADIO_DBG_ALWY, "if%lu mc_to_uc max_sta=%lu\n",
+	           if_id, max_sta);
+	return ret;
+}
+
+static const struct file_operations fops_mc_to_uc = {
+	.open    = xradio_mc_to_uc_open,
+	.read    = seq_read,
+	.write   = xradio_mc_to_uc_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static int xradio_airtime_show(struct seq_file *seq, void *v)
+{
+	struct xradio_common *hw_priv = seq->private;
+	struct xradio_airtime *at;
+	int if_id, link_id;
+
+	seq_puts(seq, "if link      used(us) pending(us) us/KB deficit\n");
+	spin_lock_bh(&hw_priv->airtime_lock);
+	for (if_id = 0; if_id < XRWL_MAX_VIFS; if_id++) {
+		for (link_id = 0; link_id < WLAN_LINK_ID_MAX; link_id++) {
+			at = &hw_priv->airtime[if_id][link_id];
+			if (!at->used && !at->pending)
+				continue;
+			seq_printf(seq, "%2d %4d %13llu %11u %5u %7d\n",
+			           if_id, link_id, at->used, at->pending,
+			           at->us_per_kb, at->deficit);
+		}
+	}
+	spin_unlock_bh(&hw_priv->airtime_lock);
+	return 0;
+}
+
+static int xradio_airtime_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &xradio_airtime_show,
+		inode->i_private);
+}
+
+static const struct file_operations fops_airtime = {
+	.open    = xradio_airtime_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
+static const struct file_operations fops_fq_codel = {
+	.open    = xradio_fq_codel_open,
+	.read    = seq_read,
+	.write   = xradio_fq_codel_set,
+	.llseek  = seq_lseek,
+	.release = single_release,
+	.owner   = THIS_MODULE,
+};
+
 //add by yangfh for disable low power mode.
 extern u16 txparse_flags;
 extern u16 rxparse_flags;
@@ -2409,6 +3167,8 @@ static int xradio_status_show_priv(struct seq_file *seq, void *v)
 		d->rx_agg);
 	seq_printf(seq, "TX align:   %d\n",
 		d->tx_align);
+	seq_printf(seq, "TX copied:  %d (align), %d (tailroom)\n",
+		d->tx_align_copy, d->tx_tail_copy);
 	seq_printf(seq, "TX TTL:     %d\n",
 		d->tx_ttl);
 	return 0;
@@ -2792,6 +3552,54 @@ int xradio_debug_init_common(struct xradio_common *hw_priv)
 		  hw_priv, &fops_bh_stat))
 		ERR_LINE;
 
+	if (!debugfs_create_file("cmd_latency", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_cmd_latency))
+		ERR_LINE;
+
+	if (!debugfs_create_file("cmd_prio", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_cmd_prio))
+		ERR_LINE;
+
+	if (!debugfs_create_file("fq_codel", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_fq_codel))
+		ERR_LINE;
+
+	if (!debugfs_create_file("airtime", S_IRUSR, d->debugfs_phy,
+		  hw_priv, &fops_airtime))
+		ERR_LINE;
+
+	if (!debugfs_create_file("vif_sched", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_vif_sched))
+		ERR_LINE;
+
+	if (!debugfs_create_file("fast_lane", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_fast_lane))
+		ERR_LINE;
+
+	if (!debugfs_create_file("amsdu", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_amsdu))
+		ERR_LINE;
+
+	if (!debugfs_create_file("block_ack", S_IRUSR, d->debugfs_phy,
+		  hw_priv, &fops_block_ack))
+		ERR_LINE;
+
+	if (!debugfs_create_file("rts", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_rts))
+		ERR_LINE;
+
+	if (!debugfs_create_file("tx_lifetime", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_tx_lifetime))
+		ERR_LINE;
+
+	if (!debugfs_create_file("ack_filter", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_ack_filter))
+		ERR_LINE;
+
+	if (!debugfs_create_file("mc_to_uc", S_IRUSR | S_IWUSR, d->debugfs_phy,
+		  hw_priv, &fops_mc_to_uc))
+		ERR_LINE;
+
 	if (!debugfs_create_file("parse_flags", S_IRUSR | S_IWUSR, d->debugfs_phy,
 		  hw_priv, &fops_parse_flags))
 		ERR_LINE;
@@ -302,15 +302,39 @@ static inline void xradio_parse_frame(u8* mac_data, u8 iv_len, u16 flags, u8 if_
 
 #ifdef CONFIG_XRADIO_DEBUGFS
 /****************************** debugfs version *******************************/
+#define XRADIO_CMD_LAT_SLOTS    64
+#define XRADIO_CMD_LAT_BUCKETS  24  /* log2(us), last one is open ended. */
+
+/* Submit-to-confirm latency of one WSM command (or MIB for 0x0005/0x0006). */
+struct xradio_cmd_lat {
+	u16 cmd;
+	u16 mib;
+	u32 count;
+	u32 rx_extended;   /* commands whose wait was extended by RX activity */
+	u32 rx_ext_loops;  /* total number of extra waits due to RX activity */
+	u32 timeout;
+	u32 max_us;
+	u64 total_us;
+	u32 hist[XRADIO_CMD_LAT_BUCKETS];
+};
+
 struct xradio_debug_common {
 	struct dentry *debugfs_phy;
 	int tx_cache_miss;
 	int tx_burst;
+	int tx_amsdu;
+	int tx_amsdu_subframes;
 	int rx_burst;
 	int ba_cnt;
 	int ba_acc;
 	int ba_cnt_rx;
 	int ba_acc_rx;
+	int cmd_lat_num;
+	struct xradio_cmd_lat cmd_lat[XRADIO_CMD_LAT_SLOTS];
+	u32 cmd_prio_rx_cut;
+	u32 cmd_prio_tx_held;
+	u32 cmd_txed_max_us;
+	u32 cmd_txed_hist[XRADIO_CMD_LAT_BUCKETS];
 #ifdef CONFIG_XRADIO_ITP
 	struct xradio_itp itp;
 #endif /* CONFIG_XRADIO_ITP */
@@ -325,6 +349,8 @@ struct xradio_debug_priv {
 	int tx_multi;
 	int tx_multi_frames;
 	int tx_align;
+	int tx_align_copy;
+	int tx_tail_copy;
 	int tx_ttl;
 };
 
@@ -393,6 +419,20 @@ static inline void xradio_debug_tx_align(struct xradio_vif *priv)
 	++priv->debug->tx_align;
 }
 
+static inline void xradio_debug_tx_align_copy(struct xradio_vif *priv)
+{
+	if (!priv->debug)
+		return;
+	++priv->debug->tx_align_copy;
+}
+
+static inline void xradio_debug_tx_tail_copy(struct xradio_vif *priv)
+{
+	if (!priv->debug)
+		return;
+	++priv->debug->tx_tail_copy;
+}
+
 static inline void xradio_debug_tx_ttl(struct xradio_vif *priv)
 {
 	if (!priv->debug)
@@ -407,6 +447,15 @@ static inline void xradio_debug_tx_burst(struct xradio_common *hw_priv)
 	++hw_priv->debug->tx_burst;
 }
 
+static inline void xradio_debug_tx_amsdu(struct xradio_common *hw_priv,
+					 int subframes)
+{
+	if (!hw_priv->debug)
+		return;
+	++hw_priv->debug->tx_amsdu;
+	hw_priv->debug->tx_amsdu_subframes += subframes;
+}
+
 static inline void xradio_debug_rx_burst(struct xradio_common *hw_priv)
 {
 	if (!hw_priv->debug)
@@ -414,6 +463,38 @@ static inline void xradio_debug_rx_burst(struct xradio_common *hw_priv)
 	++hw_priv->debug->rx_burst;
 }
 
+static inline int xradio_debug_lat_bucket(u32 us)
+{
+	return us ? min_t(int, ilog2(us), XRADIO_CMD_LAT_BUCKETS - 1) : 0;
+}
+
+static inline void xradio_debug_cmd_prio_rx_cut(struct xradio_common *hw_priv)
+{
+	if (!hw_priv->debug)
+		return;
+	++hw_priv->debug->cmd_prio_rx_cut;
+}
+
+static inline void xradio_debug_cmd_prio_tx_held(struct xradio_common *hw_priv)
+{
+	if (!hw_priv->debug)
+		return;
+	++hw_priv->debug->cmd_prio_tx_held;
+}
+
+/* Delay between wsm_cmd_send() and the command being written to the bus. */
+static inline void xradio_debug_cmd_txed(struct xradio_common *hw_priv,
+					 s64 delay_us)
+{
+	u32 us = (delay_us > 0) ? (u32)min_t(s64, delay_us, U32_MAX) : 0;
+
+	if (!hw_priv->debug)
+		return;
+	++hw_priv->debug->cmd_txed_hist[xradio_debug_lat_bucket(us)];
+	if (us > hw_priv->debug->cmd_txed_max_us)
+		hw_priv->debug->cmd_txed_max_us = us;
+}
+
 static inline void xradio_debug_ba(struct xradio_common *hw_priv,
 				   int ba_cnt, int ba_acc, int ba_cnt_rx,
 				   int ba_acc_rx)
@@ -426,6 +507,9 @@ static inline void xradio_debug_ba(struct xradio_common *hw_priv,
 	hw_priv->debug->ba_acc_rx = ba_acc_rx;
 }
 
+void xradio_debug_wsm_cmd(struct xradio_common *hw_priv, u16 cmd, u16 mib,
+                          s64 lat_us, int rx_ext_loops, bool timeout);
+
 int xradio_print_fw_version(struct xradio_common *hw_priv, u8* buf, size_t len);
 
 int   xradio_host_dbg_init(void);
@@ -488,6 +572,14 @@ static inline void xradio_debug_tx_align(struct xradio_vif *priv)
 {
 }
 
+static inline void xradio_debug_tx_align_copy(struct xradio_vif *priv)
+{
+}
+
+static inline void xradio_debug_tx_tail_copy(struct xradio_vif *priv)
+{
+}
+
 static inline void xradio_debug_tx_ttl(struct xradio_vif *priv)
 {
 }
@@ -496,16 +588,40 @@ static inline void xradio_debug_tx_burst(struct xradio_common *hw_priv)
 {
 }
 
+static inline void xradio_debug_tx_amsdu(struct xradio_common *hw_priv,
+					 int subframes)
+{
+}
+
 static inline void xradio_debug_rx_burst(struct xradio_common *hw_priv)
 {
 }
 
+static inline void xradio_debug_cmd_prio_rx_cut(struct xradio_common *hw_priv)
+{
+}
+
+static inline void xradio_debug_cmd_prio_tx_held(struct xradio_common *hw_priv)
+{
+}
+
+static inline void xradio_debug_cmd_txed(struct xradio_common *hw_priv,
+					 s64 delay_us)
+{
+}
+
 static inline void xradio_debug_ba(struct xradio_common *hw_priv,
 				   int ba_cnt, int ba_acc, int ba_cnt_rx,
 				   int ba_acc_rx)
 {
 }
 
+static inline void xradio_debug_wsm_cmd(struct xradio_common *hw_priv,
+                                        u16 cmd, u16 mib, s64 lat_us,
+                                        int rx_ext_loops, bool timeout)
+{
+}
+
 static inline int xradio_print_fw_version(struct xradio_vif *priv, 
 									u8* buf, size_t len)
 {
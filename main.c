@@ -206,6 +206,14 @@ static const unsigned long xradio_ttl[] = {
 	10 * HZ	/* BK */
 };
 
+/* MSDU lifetime of data frames, 0 leaves them to xradio_ttl[]. */
+static const unsigned long xradio_lifetime_ms[] = {
+	100,	/* VO */
+	200,	/* VI */
+	0,	/* BE */
+	0	/* BK */
+};
+
 static const struct ieee80211_ops xradio_ops = {
 	.start             = xradio_start,
 	.stop              = xradio_stop,
@@ -213,6 +221,7 @@ static const struct ieee80211_ops xradio_ops = {
 	.remove_interface  = xradio_remove_interface,
 	.change_interface  = xradio_change_interface,
 	.tx                = xradio_tx,
+	.wake_tx_queue     = xradio_wake_tx_queue,
 	.hw_scan           = xradio_hw_scan,
 #ifdef ROAM_OFFLOAD
 	.sched_scan_start  = xradio_hw_sched_scan_start,
@@ -511,7 +520,7 @@ static void xradio_set_ifce_comb(struct xradio_common *hw_priv,
 
 struct ieee80211_hw *xradio_init_common(size_t hw_priv_data_len)
 {
-	int i;
+	int i, j;
 	struct ieee80211_hw *hw;
 	struct xradio_common *hw_priv;
 	struct ieee80211_supported_band *sband;
@@ -564,12 +573,20 @@ struct ieee80211_hw *xradio_init_common(size_t hw_priv_data_len)
 	/* Initialize members of ieee80211_hw, it works in UMAC. */
 	hw->sta_data_size = sizeof(struct xradio_sta_priv);
 	hw->vif_data_size = sizeof(struct xradio_vif);
+	hw->txq_data_size = sizeof(struct xradio_txq);
 
 	ieee80211_hw_set(hw, SIGNAL_DBM);
 	ieee80211_hw_set(hw, SUPPORTS_PS);
 	ieee80211_hw_set(hw, SUPPORTS_DYNAMIC_PS);
 	ieee80211_hw_set(hw, REPORTS_TX_ACK_STATUS);
 	ieee80211_hw_set(hw, CONNECTION_MONITOR);
+	/* Per-VIF hw queues, see xradio_hw_queue(). */
+	ieee80211_hw_set(hw, QUEUE_CONTROL);
+	/* Keys only ask for IV space and the firmware adds the TKIP MIC,
+	 * so mac80211 can build data frames from its cached header. Fast
+	 * xmit does not reserve the ICV tailroom, xradio_tx_h_crypt()
+	 * grows the skb when it is short, counted in tx_tail_copy. */
+	ieee80211_hw_set(hw, SUPPORT_FAST_XMIT);
 
 /*	hw->flags = IEEE80211_HW_SIGNAL_DBM            |
 	            IEEE80211_HW_SUPPORTS_PS           |
@@ -618,7 +635,8 @@ struct ieee80211_hw *xradio_init_common(size_t hw_priv_data_len)
 #ifdef CONFIG_XRADIO_5GHZ_SUPPORT
 	hw->wiphy->bands[NL80211_BAND_5GHZ] = &xradio_band_5ghz;
 #endif /* CONFIG_XRADIO_5GHZ_SUPPORT */
-	hw->queues         = AC_QUEUE_NUM;
+	hw->queues         = XRWL_HW_QUEUES;
+	hw->offchannel_tx_hw_queue = XRWL_SHARED_HW_QUEUE;
 	hw->max_rates      = MAX_RATES_STAGE;
 	hw->max_rate_tries = MAX_RATES_RETRY;
 	/* Channel params have to be cleared before registering wiphy again */
@@ -676,6 +694,22 @@ struct ieee80211_hw *xradio_init_common(size_t hw_priv_data_len)
 	hw_priv->ba_timer.data = (unsigned long)hw_priv;
 	hw_priv->ba_timer.function = xradio_ba_timer;
 
+	for (i = 0; i < AC_QUEUE_NUM; ++i)
+		INIT_LIST_HEAD(&hw_priv->txq_active[i]);
+	spin_lock_init(&hw_priv->txq_lock);
+	spin_lock_init(&hw_priv->airtime_lock);
+	for (i = 0; i < XRWL_MAX_VIFS; ++i)
+		for (j = 0; j < WLAN_LINK_ID_MAX; ++j)
+			xradio_airtime_reset(hw_priv, i, j);
+	for (i = 0; i < XRWL_MAX_VIFS; ++i)
+		hw_priv->vif_weight[i] = XRADIO_VIF_WEIGHT;
+	hw_priv->fast_lane_mask = XRADIO_FAST_LANE_DEFAULT;
+	hw_priv->amsdu_enable   = true;
+	hw_priv->rts_auto       = true;
+	hw_priv->fq_codel_enable   = true;
+	hw_priv->fq_codel_target   = msecs_to_jiffies(XRWL_CODEL_TARGET);
+	hw_priv->fq_codel_interval = msecs_to_jiffies(XRWL_CODEL_INTERVAL);
+	hw_priv->tcp_ack_filter    = false;
 	if (unlikely(xradio_queue_stats_init(&hw_priv->tx_queue_stats,
 			WLAN_LINK_ID_MAX,xradio_skb_dtor, hw_priv))) {
 		ieee80211_free_hw(hw);
@@ -690,6 +724,8 @@ struct ieee80211_hw *xradio_init_common(size_t hw_priv_data_len)
 			ieee80211_free_hw(hw);
 			return NULL;
 		}
+		hw_priv->tx_queue[i].lifetime =
+			msecs_to_jiffies(xradio_lifetime_ms[i]);
 	}
 
 	init_waitqueue_head(&hw_priv->channel_switch_done);
@@ -701,6 +737,9 @@ struct ieee80211_hw *xradio_init_common(size_t hw_priv_data_len)
 	hw_priv->offchannel_done = 0;
 	wsm_buf_init(&hw_priv->wsm_cmd_buf);
 	spin_lock_init(&hw_priv->wsm_cmd.lock);
+	hw_priv->cmd_prio_enable   = true;
+	hw_priv->cmd_prio_rx_burst = XRADIO_CMD_PRIO_RX_BURST;
+	hw_priv->cmd_prio_tx_bufs  = XRADIO_CMD_PRIO_TX_BUFS;
 	tx_policy_init(hw_priv);
 	xradio_init_resv_skb(hw_priv);
 	/* add for setting short_frame_max_tx_count(mean wdev->retry_short) to drv,init the max_rate_tries */
@@ -720,8 +759,6 @@ struct ieee80211_hw *xradio_init_common(size_t hw_priv_data_len)
 		wsm_init_release_buffer_request(hw_priv, i);
 	hw_priv->buf_released = 0;
 #endif
-	hw_priv->vif0_throttle = XRWL_HOST_VIF0_11BG_THROTTLE;
-	hw_priv->vif1_throttle = XRWL_HOST_VIF1_11BG_THROTTLE;
 
 #if defined(CONFIG_XRADIO_DEBUG)
 	hw_priv->wsm_enable_wsm_dumps = 0;
@@ -893,6 +930,7 @@ int xradio_core_reinit(struct xradio_common *hw_priv)
 	hw_priv->device_can_sleep = 0;
 	hw_priv->hw_bufs_used = 0;
 	memset(&hw_priv->hw_bufs_used_vif, 0, sizeof(hw_priv->hw_bufs_used_vif));
+	memset(&hw_priv->vif_deficit, 0, sizeof(hw_priv->vif_deficit));
 	memset(&hw_priv->connet_time, 0, sizeof(hw_priv->connet_time));
 	atomic_set(&hw_priv->query_cnt, 0);
 	hw_priv->query_packetID = 0;
@@ -971,14 +1009,8 @@ int xradio_core_reinit(struct xradio_common *hw_priv)
 
 	/* unlock queue if need. */
 	for (i = 0; i < 4; ++i) {
-		struct xradio_queue *queue = &hw_priv->tx_queue[i];
-		spin_lock_bh(&queue->lock);
-		if (queue->tx_locked_cnt > 0) {
-			queue->tx_locked_cnt = 0;
-			ieee80211_wake_queue(hw_priv->hw, queue->queue_id);
+		if (xradio_queue_reset_lock(&hw_priv->tx_queue[i]))
 			xradio_dbg(XRADIO_DBG_WARN, "%s: unlock queue!\n", __func__);
-		}
-		spin_unlock_bh(&queue->lock);
 	}
 exit:
 #ifdef CONFIG_PM
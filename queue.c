@@ -11,15 +11,22 @@
 
 #include <net/mac80211.h>
 #include <linux/sched.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/tcp.h>
 #include "xradio.h"
 #include "queue.h"
+#include "bh.h"
 #ifdef CONFIG_XRADIO_TESTMODE
 #include <linux/time.h>
 #endif /*CONFIG_XRADIO_TESTMODE*/
 
 /* private */ struct xradio_queue_item
 {
-	struct list_head	head;
+	struct list_head	head;	/* queue, pending or free_pool */
+	struct list_head	link;	/* items of flow if queued,
+					 * stats->pending[if_id] if pending */
+	struct xradio_queue_flow *flow;
 	struct sk_buff		*skb;
 	u32			packetID;
 	unsigned long		queue_timestamp;
@@ -29,31 +36,151 @@
 	unsigned long		qdelay_timestamp;
 #endif /*CONFIG_XRADIO_TESTMODE*/
 	struct xradio_txpriv	txpriv;
+	u32			len;	/* accounted in bytes_queued_vif */
 	u8			generation;
 	u8			pack_stk_wr;
+	u8			expired;	/* see __xradio_queue_discard() */
 };
 
-static inline void __xradio_queue_lock(struct xradio_queue *queue)
+/* private */ struct xradio_queue_flow
+{
+	struct list_head	items;	/* queued items of one link */
+	struct list_head	node;	/* new_flows or old_flows of the link */
+	int			deficit;
+	u8			if_id;
+	u8			link_id;
+	/* CoDel state */
+	bool			dropping;
+	u32			drop_count;
+	unsigned long		first_above;
+	unsigned long		drop_next;
+};
+
+/* private */ struct xradio_queue_link
+{
+	struct list_head	new_flows;
+	struct list_head	old_flows;
+	/* Unhashed frames and hash collisions with other links. */
+	struct xradio_queue_flow default_flow;
+	/* Fast lane frames, served before all flows. */
+	struct xradio_queue_flow fast_flow;
+	int			count;	/* queued items */
+	int			fast_count;
+	int			vo_budget; /* VO fast lane frames left */
+	u32			expired; /* data frames over their lifetime */
+};
+
+/* The hw queue of a VIF is stopped while the queue is locked or the
+ * VIF is over its byte limit. Must be called with queue->lock held. */
+static void __xradio_queue_hw_update(struct xradio_queue *queue, int if_id)
+{
+	struct xradio_common *hw_priv = queue->stats->hw_priv;
+	struct ieee80211_hw *hw = hw_priv->hw;
+	bool stop = queue->tx_locked_cnt || (queue->bql_stopped & BIT(if_id));
+
+	if (stop == !!(queue->hw_stopped & BIT(if_id)))
+		return;
+
+	if (stop) {
+		queue->hw_stopped |= BIT(if_id);
+		ieee80211_stop_queue(hw, xradio_hw_queue(if_id, queue->queue_id));
+	} else {
+		queue->hw_stopped &= ~BIT(if_id);
+		ieee80211_wake_queue(hw, xradio_hw_queue(if_id, queue->queue_id));
+		/* Let BH pull what waits in the mac80211 TXQs. */
+		if (!list_empty(&hw_priv->txq_active[queue->queue_id]))
+			xradio_bh_wakeup(hw_priv);
+	}
+}
+
+/* The shared hw queue is stopped while any queue is locked. */
+static void __xradio_queue_shared_update(struct xradio_queue *queue,
+					 bool locked)
 {
 	struct xradio_queue_stats *stats = queue->stats;
+	u32 old;
+
+	spin_lock_bh(&stats->lock);
+	old = stats->locked_map;
+	if (locked)
+		stats->locked_map |= BIT(queue->queue_id);
+	else
+		stats->locked_map &= ~BIT(queue->queue_id);
+	if (!old && stats->locked_map)
+		ieee80211_stop_queue(stats->hw_priv->hw, XRWL_SHARED_HW_QUEUE);
+	else if (old && !stats->locked_map)
+		ieee80211_wake_queue(stats->hw_priv->hw, XRWL_SHARED_HW_QUEUE);
+	spin_unlock_bh(&stats->lock);
+}
+
+static inline void __xradio_queue_lock(struct xradio_queue *queue)
+{
+	int i;
 	if (queue->tx_locked_cnt++ == 0) {
 		txrx_printk(XRADIO_DBG_MSG, "[TX] Queue %d is locked.\n",
 				queue->queue_id);
-		ieee80211_stop_queue(stats->hw_priv->hw, queue->queue_id);
+		for (i = 0; i < XRWL_MAX_VIFS; i++)
+			__xradio_queue_hw_update(queue, i);
+		__xradio_queue_shared_update(queue, true);
 	}
 }
 
 static inline void __xradio_queue_unlock(struct xradio_queue *queue)
 {
-	struct xradio_queue_stats *stats = queue->stats;
+	int i;
 	SYS_BUG(!queue->tx_locked_cnt);
 	if (--queue->tx_locked_cnt == 0) {
 		txrx_printk(XRADIO_DBG_MSG, "[TX] Queue %d is unlocked.\n",
 				queue->queue_id);
-		ieee80211_wake_queue(stats->hw_priv->hw, queue->queue_id);
+		for (i = 0; i < XRWL_MAX_VIFS; i++)
+			__xradio_queue_hw_update(queue, i);
+		__xradio_queue_shared_update(queue, false);
 	}
 }
 
+/* Stop a VIF when its not yet sent bytes reach the limit, wake it when
+ * half of them are gone. Must be called with queue->lock held. */
+static void __xradio_queue_bql_update(struct xradio_queue *queue, int if_id)
+{
+	size_t bytes = queue->bytes_queued_vif[if_id];
+	size_t limit = queue->bql_limit[if_id];
+
+	if (!(queue->bql_stopped & BIT(if_id))) {
+		if (bytes < limit)
+			return;
+		queue->bql_stopped |= BIT(if_id);
+	} else {
+		if (bytes > (limit >> 1))
+			return;
+		queue->bql_stopped &= ~BIT(if_id);
+	}
+	__xradio_queue_hw_update(queue, if_id);
+}
+
+/* Move the limit towards the bytes confirmed in XRWL_BQL_TARGET. */
+static void __xradio_queue_bql_complete(struct xradio_queue *queue,
+					int if_id, u32 len)
+{
+	unsigned long elapsed = jiffies - queue->bql_stamp[if_id];
+	size_t target;
+
+	queue->bql_completed[if_id] += len;
+	if (elapsed < XRWL_BQL_INTERVAL)
+		return;
+
+	/* A longer gap means the VIF was idle, don't learn from it. */
+	if (elapsed < 2 * XRWL_BQL_INTERVAL) {
+		target = queue->bql_completed[if_id] * XRWL_BQL_TARGET / elapsed;
+		target = clamp_t(size_t, target,
+				 XRWL_BQL_MIN_LIMIT, XRWL_BQL_MAX_LIMIT);
+		queue->bql_limit[if_id] =
+			(3 * queue->bql_limit[if_id] + target) >> 2;
+		__xradio_queue_bql_update(queue, if_id);
+	}
+	queue->bql_completed[if_id] = 0;
+	queue->bql_stamp[if_id] = jiffies;
+}
+
 static inline void xradio_queue_parse_id(u32 packetID, u8 *queue_generation,
 						u8 *queue_id,
 						u8 *item_generation,
@@ -82,28 +209,476 @@ static inline u32 xradio_queue_make_packet_id(u8 queue_generation, u8 queue_id,
 		((u32)queue_generation << 28);
 }
 
-static void xradio_queue_post_gc(struct xradio_queue_stats *stats,
-				 struct list_head *gc_list)
+/* Shared per-link counters, must be called with stats->lock held. */
+static inline void __xradio_queue_stats_inc(struct xradio_queue_stats *stats,
+					    u8 if_id, u8 link_id)
+{
+	++stats->num_queued[if_id];
+	if (!stats->link_map_cache[if_id][link_id]++)
+		stats->link_map[if_id] |= BIT(link_id);
+}
+
+/* Returns true if the link became empty. */
+static inline bool __xradio_queue_stats_dec(struct xradio_queue_stats *stats,
+					    u8 if_id, u8 link_id)
+{
+	--stats->num_queued[if_id];
+	if (!--stats->link_map_cache[if_id][link_id]) {
+		stats->link_map[if_id] &= ~BIT(link_id);
+		return true;
+	}
+	return false;
+}
+
+/* A flow serves one link at a time: a hashed flow already in use by
+ * another link falls back to the default flow of the link. */
+static inline struct xradio_queue_flow *
+__xradio_queue_flow_claim(struct xradio_queue *queue,
+			  struct xradio_queue_flow *flow,
+			  u8 if_id, u8 link_id)
+{
+	struct xradio_queue_link *link = &queue->link_queue[if_id][link_id];
+
+	if (!flow)
+		return &link->default_flow;
+	if (list_empty(&flow->node)) {
+		if (flow->if_id != if_id || flow->link_id != link_id) {
+			flow->if_id = if_id;
+			flow->link_id = link_id;
+			flow->dropping = false;
+			flow->drop_count = 0;
+			flow->first_above = 0;
+		}
+	} else if (flow->if_id != if_id || flow->link_id != link_id) {
+		return &link->default_flow;
+	}
+	return flow;
+}
+
+/* Data frames are spread over the hashed flows, everything else goes
+ * to the default flow of the link and is never dropped by CoDel. */
+static inline struct xradio_queue_flow *
+__xradio_queue_flow_hash(struct xradio_queue *queue, struct sk_buff *skb,
+			 const struct xradio_txpriv *txpriv)
+{
+	struct ieee80211_hdr *hdr =
+		(struct ieee80211_hdr *)&skb->data[txpriv->offset];
+
+	if (!queue->stats->hw_priv->fq_codel_enable ||
+	    !ieee80211_is_data(hdr->frame_control) ||
+	    skb->protocol == cpu_to_be16(ETH_P_PAE))
+		return NULL;
+	return &queue->flows[reciprocal_scale(skb_get_hash(skb),
+					      XRWL_FQ_FLOWS)];
+}
+
+/* The fast lane of a link goes first unless its head is VO data and the
+ * link used up its VO budget. */
+static inline void __xradio_queue_fast_update(struct xradio_queue *queue,
+					      struct xradio_queue_link *link,
+					      int if_id, int link_id)
 {
 	struct xradio_queue_item *item;
+	bool first = false;
 
-	while (!list_empty(gc_list)) {
-		item = list_first_entry(
-			gc_list, struct xradio_queue_item, head);
-		list_del(&item->head);
-		stats->skb_dtor(stats->hw_priv, item->skb, &item->txpriv);
-		kfree(item);
+	if (link->fast_count) {
+		item = list_first_entry(&link->fast_flow.items,
+					struct xradio_queue_item, link);
+		first = link->vo_budget ||
+			item->txpriv.fast_lane != XRADIO_FAST_LANE_VOICE;
+	}
+	if (first)
+		queue->fast_map[if_id] |= BIT(link_id);
+	else
+		queue->fast_map[if_id] &= ~BIT(link_id);
+}
+
+/* Per-link flows of queued items, must be called with queue->lock held. */
+static inline void __xradio_queue_link_add(struct xradio_queue *queue,
+					   struct xradio_queue_item *item,
+					   bool front)
+{
+	u8 if_id = item->txpriv.if_id;
+	u8 link_id = item->txpriv.link_id;
+	struct xradio_queue_link *link = &queue->link_queue[if_id][link_id];
+	struct xradio_queue_flow *flow;
+
+	if (item->txpriv.fast_lane) {
+		flow = &link->fast_flow;
+		++link->fast_count;
+		++queue->num_fast;
+	} else {
+		flow = __xradio_queue_flow_claim(queue, item->flow,
+						 if_id, link_id);
+	}
+	item->flow = flow;
+	if (front)
+		list_add(&item->link, &flow->items);
+	else
+		list_add_tail(&item->link, &flow->items);
+	if (flow == &link->fast_flow) {
+		__xradio_queue_fast_update(queue, link, if_id, link_id);
+	} else if (list_empty(&flow->node)) {
+		flow->deficit = XRWL_FQ_QUANTUM;
+		list_add_tail(&flow->node, &link->new_flows);
+	}
+	++link->count;
+	queue->link_map[if_id] |= BIT(link_id);
+}
+
+static inline void __xradio_queue_link_del(struct xradio_queue *queue,
+					   struct xradio_queue_item *item)
+{
+	u8 if_id = item->txpriv.if_id;
+	u8 link_id = item->txpriv.link_id;
+	struct xradio_queue_link *link = &queue->link_queue[if_id][link_id];
+	struct xradio_queue_flow *flow, *tmp;
+
+	list_del(&item->link);
+	if (item->flow == &link->fast_flow) {
+		--link->fast_count;
+		--queue->num_fast;
+	}
+	if (!--link->count) {
+		queue->link_map[if_id] &= ~BIT(link_id);
+		link->vo_budget = XRADIO_FAST_LANE_VO_BUDGET;
+		/* Empty flows wait in the lists until fq_peek passes them,
+		 * an idle link is never peeked and would keep them. */
+		list_for_each_entry_safe(flow, tmp, &link->new_flows, node)
+			list_del_init(&flow->node);
+		list_for_each_entry_safe(flow, tmp, &link->old_flows, node)
+			list_del_init(&flow->node);
+	}
+	__xradio_queue_fast_update(queue, link, if_id, link_id);
+}
+
+/* Take a queued item out for CoDel or its lifetime. It is freed by the
+ * gc timer, as the caller may hold locks that skb_dtor needs. */
+static void __xradio_queue_drop(struct xradio_queue *queue,
+				struct xradio_queue_item *item)
+{
+	struct xradio_queue_stats *stats = queue->stats;
+	u8 if_id = item->txpriv.if_id;
+	u8 link_id = item->txpriv.link_id;
+
+	--queue->num_queued;
+	--queue->num_queued_vif[if_id];
+	--queue->link_map_cache[if_id][link_id];
+	queue->bytes_queued_vif[if_id] -= item->len;
+	spin_lock_bh(&stats->lock);
+	__xradio_queue_stats_dec(stats, if_id, link_id);
+	spin_unlock_bh(&stats->lock);
+	__xradio_queue_link_del(queue, item);
+	list_move_tail(&item->head, &queue->drop_list);
+	__xradio_queue_bql_update(queue, if_id);
+	mod_timer(&queue->gc, jiffies);
+}
+
+/* Whether mac80211 numbered @item for a TID the firmware runs TX block
+ * ack on, so the receiver reorder buffer would wait for its seq. */
+static bool __xradio_queue_in_ba(struct xradio_queue *queue,
+				 struct xradio_queue_item *item)
+{
+	struct ieee80211_hdr *hdr =
+		(struct ieee80211_hdr *)&item->skb->data[item->txpriv.offset];
+	struct xradio_vif *priv;
+
+	if (item->txpriv.tid >= XRADIO_MAX_TID ||
+	    !ieee80211_is_data_qos(hdr->frame_control) ||
+	    is_multicast_ether_addr(hdr->addr1))
+		return false;
+	priv = __xrwl_hwpriv_to_vifpriv(queue->stats->hw_priv,
+					item->txpriv.if_id);
+	return priv && (READ_ONCE(priv->ba_fw_mask) & BIT(item->txpriv.tid));
+}
+
+/* Drop a queued item for CoDel, its lifetime or the ACK filter. One
+ * under block ack stays queued instead and goes to the firmware already
+ * expired, which discards it and moves its window on. Returns false if
+ * the item was kept. */
+static bool __xradio_queue_discard(struct xradio_queue *queue,
+				   struct xradio_queue_item *item)
+{
+	if (__xradio_queue_in_ba(queue, item)) {
+		item->expired = 1;
+		return false;
+	}
+	__xradio_queue_drop(queue, item);
+	return true;
+}
+
+static bool __xradio_queue_codel_should_drop(struct xradio_queue *queue,
+					     struct xradio_queue_flow *flow,
+					     struct xradio_queue_item *item,
+					     unsigned long now)
+{
+	struct xradio_common *hw_priv = queue->stats->hw_priv;
+
+	if (time_before(now, item->queue_timestamp +
+			     hw_priv->fq_codel_target) ||
+	    list_is_singular(&flow->items)) {
+		flow->first_above = 0;
+		return false;
+	}
+	if (!flow->first_above) {
+		flow->first_above = now + hw_priv->fq_codel_interval;
+		return false;
+	}
+	return time_after_eq(now, flow->first_above);
+}
+
+/* CoDel control law: interval / sqrt(drop_count) after t. */
+static inline unsigned long
+__xradio_queue_codel_next(struct xradio_queue *queue, unsigned long t,
+			  u32 drop_count)
+{
+	unsigned long interval = queue->stats->hw_priv->fq_codel_interval;
+
+	return t + interval * 1024 /
+		int_sqrt((unsigned long)min_t(u32, drop_count, 1024) << 20);
+}
+
+/* Head of the flow after CoDel drops, it stays queued. A frame CoDel
+ * picked but had to keep, see __xradio_queue_discard(), is the head. */
+static struct xradio_queue_item *
+__xradio_queue_codel_peek(struct xradio_queue *queue,
+			  struct xradio_queue_link *link,
+			  struct xradio_queue_flow *flow)
+{
+	struct xradio_common *hw_priv = queue->stats->hw_priv;
+	struct xradio_queue_item *item;
+	unsigned long now = jiffies;
+	bool drop;
+
+	if (list_empty(&flow->items)) {
+		flow->dropping = false;
+		return NULL;
+	}
+	item = list_first_entry(&flow->items, struct xradio_queue_item, link);
+	if (!hw_priv->fq_codel_enable || flow == &link->default_flow ||
+	    item->expired)
+		return item;
+
+	drop = __xradio_queue_codel_should_drop(queue, flow, item, now);
+	if (flow->dropping) {
+		if (!drop)
+			flow->dropping = false;
+		while (flow->dropping && time_after_eq(now, flow->drop_next)) {
+			++queue->num_fq_drops;
+			++flow->drop_count;
+			if (!__xradio_queue_discard(queue, item)) {
+				flow->drop_next = __xradio_queue_codel_next(
+					queue, flow->drop_next,
+					flow->drop_count);
+				return item;
+			}
+			if (list_empty(&flow->items)) {
+				flow->dropping = false;
+				return NULL;
+			}
+			item = list_first_entry(&flow->items,
+					struct xradio_queue_item, link);
+			if (!__xradio_queue_codel_should_drop(queue, flow,
+							      item, now))
+				flow->dropping = false;
+			else
+				flow->drop_next = __xradio_queue_codel_next(
+					queue, flow->drop_next,
+					flow->drop_count);
+		}
+	} else if (drop) {
+		++queue->num_fq_drops;
+		flow->dropping = true;
+		if (flow->drop_count > 2 &&
+		    time_before(now, flow->drop_next +
+				     16 * hw_priv->fq_codel_interval))
+			flow->drop_count -= 2;
+		else
+			flow->drop_count = 1;
+		flow->drop_next = __xradio_queue_codel_next(queue, now,
+							    flow->drop_count);
+		if (!__xradio_queue_discard(queue, item))
+			return item;
+		if (list_empty(&flow->items))
+			return NULL;
+		item = list_first_entry(&flow->items,
+				struct xradio_queue_item, link);
 	}
+	return item;
 }
 
-static void xradio_queue_register_post_gc(struct list_head *gc_list,
-				     struct xradio_queue_item *item)
+/* Fast lane first, see __xradio_queue_fast_update(), then deficit round
+ * robin between the flows of a link, new flows first. */
+static struct xradio_queue_item *
+__xradio_queue_fq_peek(struct xradio_queue *queue,
+		       struct xradio_queue_link *link)
 {
-	struct xradio_queue_item *gc_item;
-	gc_item = xr_kmalloc(sizeof(struct xradio_queue_item), false);
-	SYS_BUG(!gc_item);
-	memcpy(gc_item, item, sizeof(struct xradio_queue_item));
-	list_add_tail(&gc_item->head, gc_list);
+	struct xradio_queue_flow *flow;
+	struct xradio_queue_item *item;
+	struct list_head *head;
+
+	if (queue->fast_map[link->default_flow.if_id] &
+	    BIT(link->default_flow.link_id))
+		return list_first_entry(&link->fast_flow.items,
+					struct xradio_queue_item, link);
+
+	for (;;) {
+		head = &link->new_flows;
+		if (list_empty(head)) {
+			head = &link->old_flows;
+			if (list_empty(head))
+				break;
+		}
+		flow = list_first_entry(head, struct xradio_queue_flow, node);
+
+		if (flow->deficit <= 0) {
+			flow->deficit += XRWL_FQ_QUANTUM;
+			list_move_tail(&flow->node, &link->old_flows);
+			continue;
+		}
+
+		item = __xradio_queue_codel_peek(queue, link, flow);
+		if (!item) {
+			/* An emptied new flow goes behind the old ones, so a
+			 * sparse flow cannot keep its precedence. */
+			if (head == &link->new_flows &&
+			    !list_empty(&link->old_flows))
+				list_move_tail(&flow->node, &link->old_flows);
+			else
+				list_del_init(&flow->node);
+			continue;
+		}
+
+		/* Charged by the caller once the item is taken. */
+		return item;
+	}
+
+	/* VO held back by its budget, with nothing else to send. */
+	if (link->fast_count)
+		return list_first_entry(&link->fast_flow.items,
+					struct xradio_queue_item, link);
+	return NULL;
+}
+
+/* MSDU lifetime of a queued data frame, 0 if it has none. Frames for
+ * connection setup are sent however late they are. */
+static inline unsigned long
+__xradio_queue_lifetime(struct xradio_queue *queue,
+			struct xradio_queue_item *item)
+{
+	struct ieee80211_hdr *hdr =
+		(struct ieee80211_hdr *)&item->skb->data[item->txpriv.offset];
+
+	if (!queue->lifetime || item->txpriv.use_bg_rate ||
+	    !ieee80211_is_data_present(hdr->frame_control))
+		return 0;
+	return queue->lifetime;
+}
+
+/* Round robin over the non-empty links allowed by link_id_map, links
+ * with fast lane frames first. A link whose next frame waits for its
+ * rate policy to reach the device is passed over and *held is set. */
+static inline struct xradio_queue_item *
+__xradio_queue_link_first(struct xradio_queue *queue, int if_id,
+			  u32 link_id_map, bool *held)
+{
+	struct xradio_common *hw_priv = queue->stats->hw_priv;
+	struct xradio_queue_link *link;
+	struct xradio_queue_item *item;
+	unsigned long lifetime;
+	u32 map, next;
+	int rr, link_id;
+
+	while ((map = queue->link_map[if_id] & link_id_map)) {
+		if (queue->fast_map[if_id] & map)
+			map &= queue->fast_map[if_id];
+		rr = queue->link_rr[if_id] + 1;
+		next = (rr < 32) ? (map & (~0U << rr)) : 0;
+		link_id = next ? __ffs(next) : __ffs(map);
+		queue->link_rr[if_id] = link_id;
+
+		/* NULL only if CoDel dropped all frames of the link. */
+		link = &queue->link_queue[if_id][link_id];
+		item = __xradio_queue_fq_peek(queue, link);
+		while (item && !item->expired &&
+		       (lifetime = __xradio_queue_lifetime(queue, item)) &&
+		       time_after_eq(jiffies, item->queue_timestamp + lifetime)) {
+			/* Late frames only burn airtime. */
+			++queue->num_expired;
+			++link->expired;
+			if (!__xradio_queue_discard(queue, item))
+				break;
+			item = __xradio_queue_fq_peek(queue, link);
+		}
+		if (!item)
+			continue;
+		if (!tx_policy_ready(hw_priv, item->txpriv.rate_id) &&
+		    !tx_policy_fallback(hw_priv, item->skb, &item->txpriv)) {
+			link_id_map &= ~BIT(link_id);
+			*held = true;
+			continue;
+		}
+		if (item->flow != &link->fast_flow) {
+			item->flow->deficit -= item->len;
+			link->vo_budget = XRADIO_FAST_LANE_VO_BUDGET;
+		} else if (item->txpriv.fast_lane == XRADIO_FAST_LANE_VOICE &&
+			   link->vo_budget) {
+			--link->vo_budget;
+		}
+		return item;
+	}
+	return NULL;
+}
+
+/* Oldest pending frame of all queues for if_id, other than skip_id.
+ * Frames enter stats->pending in xmit order, so at most two entries per
+ * VIF are looked at. Called under stats->lock. */
+static struct xradio_queue_item *
+__xradio_queue_oldest_pending(struct xradio_queue_stats *stats, int if_id,
+			      u32 skip_id)
+{
+	struct xradio_queue_item *item, *oldest = NULL;
+	int i;
+
+	for (i = 0; i < XRWL_MAX_VIFS; i++) {
+		if (if_id != XRWL_GENERIC_IF_ID && if_id != XRWL_ALL_IFS &&
+		    i != if_id)
+			continue;
+		list_for_each_entry(item, &stats->pending[i], link) {
+			if (item->packetID == skip_id)
+				continue;
+			if (!oldest || time_before(item->xmit_timestamp,
+						   oldest->xmit_timestamp))
+				oldest = item;
+			break;
+		}
+	}
+	return oldest;
+}
+
+/* Items on gc_list were detached from the queue under queue->lock but
+ * still own their skb. Destruct them without the lock held and give
+ * them back to the free pool afterwards. */
+static void xradio_queue_post_gc(struct xradio_queue *queue,
+				 struct list_head *gc_list)
+{
+	struct xradio_queue_stats *stats = queue->stats;
+	struct xradio_queue_item *item;
+	size_t n = 0;
+
+	if (list_empty(gc_list))
+		return;
+
+	list_for_each_entry(item, gc_list, head) {
+		stats->skb_dtor(stats->hw_priv, item->skb, &item->txpriv);
+		item->skb = NULL;
+		n++;
+	}
+
+	spin_lock_bh(&queue->lock);
+	list_splice_tail_init(gc_list, &queue->free_pool);
+	queue->num_free += n;
+	spin_unlock_bh(&queue->lock);
 }
 
 static void __xradio_queue_gc(struct xradio_queue *queue,
@@ -128,9 +703,9 @@ static void __xradio_queue_gc(struct xradio_queue *queue,
 		--queue->num_queued;
 		--queue->num_queued_vif[if_id];
 		--queue->link_map_cache[if_id][txpriv->link_id];
+		queue->bytes_queued_vif[if_id] -= item->len;
 		spin_lock_bh(&stats->lock);
-		--stats->num_queued[if_id];
-		if (!--stats->link_map_cache[if_id][txpriv->link_id])
+		if (__xradio_queue_stats_dec(stats, if_id, txpriv->link_id))
 			wakeup_stats = true;
 		spin_unlock_bh(&stats->lock);
 		//priv = xrwl_hwpriv_to_vifpriv(stats->hw_priv, if_id);
@@ -138,18 +713,18 @@ static void __xradio_queue_gc(struct xradio_queue *queue,
 		//	xradio_debug_tx_ttl(priv);
 		//	spin_unlock(&priv->vif_lock);
 		//}
-		xradio_queue_register_post_gc(head, item);
-		item->skb = NULL;
-		list_move_tail(&item->head, &queue->free_pool);
+		__xradio_queue_link_del(queue, item);
+		list_move_tail(&item->head, head);
 	}
 
 	if (wakeup_stats)
 		wake_up(&stats->wait_link_id_empty);
-	
-	//modified by yangfh for test WFD
+
+	for (if_id = 0; if_id < XRWL_MAX_VIFS; if_id++)
+		__xradio_queue_bql_update(queue, if_id);
+
 	if (queue->overfull) {
-		if (queue->num_queued <= ((stats->hw_priv->vif0_throttle +
-						stats->hw_priv->vif1_throttle+2)>>1)) {
+		if (queue->num_queued <= (queue->capacity >> 1)) {
 			queue->overfull = false;
 			if (unlock) {
 				__xradio_queue_unlock(queue);
@@ -169,10 +744,16 @@ static void xradio_queue_gc(unsigned long arg)
 	struct xradio_queue *queue =
 		(struct xradio_queue *)arg;
 
+	bool dropped;
+
 	spin_lock_bh(&queue->lock);
+	dropped = !list_empty(&queue->drop_list);
+	list_splice_tail_init(&queue->drop_list, &list);
 	__xradio_queue_gc(queue, &list, true);
 	spin_unlock_bh(&queue->lock);
-	xradio_queue_post_gc(queue->stats, &list);
+	if (dropped)
+		wake_up(&queue->stats->wait_link_id_empty);
+	xradio_queue_post_gc(queue, &list);
 }
 
 int xradio_queue_stats_init(struct xradio_queue_stats *stats,
@@ -182,12 +763,18 @@ int xradio_queue_stats_init(struct xradio_queue_stats *stats,
 {
 	int i;
 
+	/* Links of a VIF are tracked in u32 bitmaps. */
+	if (SYS_WARN(map_capacity > 32))
+		return -EINVAL;
+
 	memset(stats, 0, sizeof(*stats));
 	stats->map_capacity = map_capacity;
 	stats->skb_dtor = skb_dtor;
 	stats->hw_priv = hw_priv;
 	spin_lock_init(&stats->lock);
 	init_waitqueue_head(&stats->wait_link_id_empty);
+	for (i = 0; i < XRWL_MAX_VIFS; i++)
+		INIT_LIST_HEAD(&stats->pending[i]);
 	for (i = 0; i < XRWL_MAX_VIFS; i++) {
 		stats->link_map_cache[i] = xr_kzalloc(sizeof(int[map_capacity]), false);
 		if (!stats->link_map_cache[i]) {
@@ -200,13 +787,22 @@ int xradio_queue_stats_init(struct xradio_queue_stats *stats,
 	return 0;
 }
 
+static void xradio_queue_flow_init(struct xradio_queue_flow *flow,
+				   u8 if_id, u8 link_id)
+{
+	INIT_LIST_HEAD(&flow->items);
+	INIT_LIST_HEAD(&flow->node);
+	flow->if_id = if_id;
+	flow->link_id = link_id;
+}
+
 int xradio_queue_init(struct xradio_queue *queue,
 		      struct xradio_queue_stats *stats,
 		      u8 queue_id,
 		      size_t capacity,
 		      unsigned long ttl)
 {
-	int i;
+	int i, j;
 
 	memset(queue, 0, sizeof(*queue));
 	queue->stats = stats;
@@ -215,7 +811,12 @@ int xradio_queue_init(struct xradio_queue *queue,
 	queue->ttl = ttl;
 	INIT_LIST_HEAD(&queue->queue);
 	INIT_LIST_HEAD(&queue->pending);
+	for (i = 0; i < XRWL_MAX_VIFS; i++) {
+		queue->bql_limit[i] = XRWL_BQL_MAX_LIMIT;
+		queue->bql_stamp[i] = jiffies;
+	}
 	INIT_LIST_HEAD(&queue->free_pool);
+	INIT_LIST_HEAD(&queue->drop_list);
 	spin_lock_init(&queue->lock);
 	init_timer(&queue->gc);
 	queue->gc.data = (unsigned long)queue;
@@ -226,20 +827,57 @@ int xradio_queue_init(struct xradio_queue *queue,
 	if (!queue->pool)
 		return -ENOMEM;
 
+	queue->flows = xr_kzalloc(sizeof(struct xradio_queue_flow) *
+	                          XRWL_FQ_FLOWS, false);
+	if (!queue->flows) {
+		kfree(queue->pool);
+		queue->pool = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < XRWL_FQ_FLOWS; i++)
+		xradio_queue_flow_init(&queue->flows[i], 0, 0);
+
 	for (i = 0; i < XRWL_MAX_VIFS; i++) {
 		queue->link_map_cache[i] =
 				xr_kzalloc(sizeof(int[stats->map_capacity]), false);
 		if (!queue->link_map_cache[i]) {
 			for (; i >= 0; i--)
 				kfree(queue->link_map_cache[i]);
+			kfree(queue->flows);
+			queue->flows = NULL;
+			kfree(queue->pool);
+			queue->pool = NULL;
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0; i < XRWL_MAX_VIFS; i++) {
+		queue->link_queue[i] = xr_kzalloc(sizeof(struct xradio_queue_link) *
+		                                  stats->map_capacity, false);
+		if (!queue->link_queue[i]) {
+			for (; i >= 0; i--)
+				kfree(queue->link_queue[i]);
+			for (i = 0; i < XRWL_MAX_VIFS; i++)
+				kfree(queue->link_map_cache[i]);
+			kfree(queue->flows);
+			queue->flows = NULL;
 			kfree(queue->pool);
 			queue->pool = NULL;
 			return -ENOMEM;
 		}
+		for (j = 0; j < stats->map_capacity; j++) {
+			struct xradio_queue_link *link = &queue->link_queue[i][j];
+			INIT_LIST_HEAD(&link->new_flows);
+			INIT_LIST_HEAD(&link->old_flows);
+			xradio_queue_flow_init(&link->default_flow, i, j);
+			xradio_queue_flow_init(&link->fast_flow, i, j);
+			link->vo_budget = XRADIO_FAST_LANE_VO_BUDGET;
+		}
 	}
 
 	for (i = 0; i < capacity; ++i)
 		list_add_tail(&queue->pool[i].head, &queue->free_pool);
+	queue->num_free = capacity;
 
 	return 0;
 }
@@ -247,35 +885,66 @@ int xradio_queue_init(struct xradio_queue *queue,
 /* TODO:COMBO: Flush only a particular interface specific parts */
 int xradio_queue_clear(struct xradio_queue *queue, int if_id)
 {
-	int i, cnt, iter;
+	int i, cnt, pending_cnt, iter;
 	struct xradio_queue_stats *stats = queue->stats;
+	struct xradio_queue_item *item, *tmp;
+	struct xradio_queue_flow *flow;
 	LIST_HEAD(gc_list);
 
 	cnt = 0;
+	pending_cnt = 0;
 	spin_lock_bh(&queue->lock);
+	/* CoDel drops are accounted already, free them with the rest. */
+	list_splice_tail_init(&queue->drop_list, &gc_list);
 	queue->generation++;
 	queue->generation &= 0xf;
-	list_splice_tail_init(&queue->queue, &queue->pending);
-	while (!list_empty(&queue->pending)) {
-		struct xradio_queue_item *item = list_first_entry(
-			&queue->pending, struct xradio_queue_item, head);
+	list_for_each_entry_safe(item, tmp, &queue->queue, head) {
 		SYS_WARN(!item->skb);
 		if (XRWL_ALL_IFS == if_id || item->txpriv.if_id == if_id) {
-			xradio_queue_register_post_gc(&gc_list, item);
-			item->skb = NULL;
-			list_move_tail(&item->head, &queue->free_pool);
+			__xradio_queue_link_del(queue, item);
+			list_move_tail(&item->head, &gc_list);
 			cnt++;
+		} else {
+			/* Not sent yet, give it an ID of the new generation. */
+			item->packetID = xradio_queue_make_packet_id(
+				queue->generation, queue->queue_id,
+				item->generation, item - queue->pool,
+				item->txpriv.if_id, item->txpriv.raw_link_id);
+		}
+	}
+	/* Empty flows are released already, their CoDel state goes too. */
+	for (i = 0; i < XRWL_FQ_FLOWS; i++) {
+		flow = &queue->flows[i];
+		if (list_empty(&flow->items)) {
+			list_del_init(&flow->node);
+			flow->dropping = false;
+			flow->drop_count = 0;
+			flow->first_above = 0;
 		}
 	}
-	queue->num_queued -= cnt;
-	queue->num_pending = 0;
+	spin_lock_bh(&stats->lock);
+	list_for_each_entry_safe(item, tmp, &queue->pending, head) {
+		SYS_WARN(!item->skb);
+		if (XRWL_ALL_IFS == if_id || item->txpriv.if_id == if_id) {
+			list_del(&item->link);
+			list_move_tail(&item->head, &gc_list);
+			pending_cnt++;
+		}
+	}
+	spin_unlock_bh(&stats->lock);
+	queue->num_queued -= cnt + pending_cnt;
+	queue->num_pending -= pending_cnt;
 	if (XRWL_ALL_IFS != if_id) {
 		queue->num_queued_vif[if_id] = 0;
 		queue->num_pending_vif[if_id] = 0;
+		queue->bytes_queued_vif[if_id] = 0;
+		__xradio_queue_bql_update(queue, if_id);
 	} else {
 		for (iter = 0; iter < XRWL_MAX_VIFS; iter++) {
 			queue->num_queued_vif[iter] = 0;
 			queue->num_pending_vif[iter] = 0;
+			queue->bytes_queued_vif[iter] = 0;
+			__xradio_queue_bql_update(queue, iter);
 		}
 	}
 	spin_lock_bh(&stats->lock);
@@ -286,6 +955,8 @@ int xradio_queue_clear(struct xradio_queue *queue, int if_id)
 			stats->link_map_cache[if_id][i] -=
 				queue->link_map_cache[if_id][i];
 			queue->link_map_cache[if_id][i] = 0;
+			if (!stats->link_map_cache[if_id][i])
+				stats->link_map[if_id] &= ~BIT(i);
 		}
 	} else {
 		for (iter = 0; iter < XRWL_MAX_VIFS; iter++) {
@@ -295,6 +966,8 @@ int xradio_queue_clear(struct xradio_queue *queue, int if_id)
 				stats->link_map_cache[iter][i] -=
 					queue->link_map_cache[iter][i];
 				queue->link_map_cache[iter][i] = 0;
+				if (!stats->link_map_cache[iter][i])
+					stats->link_map[iter] &= ~BIT(i);
 			}
 		}
 	}
@@ -305,7 +978,7 @@ int xradio_queue_clear(struct xradio_queue *queue, int if_id)
 	}
 	spin_unlock_bh(&queue->lock);
 	wake_up(&stats->wait_link_id_empty);
-	xradio_queue_post_gc(stats, &gc_list);
+	xradio_queue_post_gc(queue, &gc_list);
 	return 0;
 }
 
@@ -327,9 +1000,13 @@ void xradio_queue_deinit(struct xradio_queue *queue)
 	del_timer_sync(&queue->gc);
 	INIT_LIST_HEAD(&queue->free_pool);
 	kfree(queue->pool);
+	kfree(queue->flows);
+	queue->flows = NULL;
 	for (i = 0; i < XRWL_MAX_VIFS; i++) {
 		kfree(queue->link_map_cache[i]);
 		queue->link_map_cache[i] = NULL;
+		kfree(queue->link_queue[i]);
+		queue->link_queue[i] = NULL;
 	}
 	queue->pool = NULL;
 	queue->capacity = 0;
@@ -340,95 +1017,305 @@ size_t xradio_queue_get_num_queued(struct xradio_vif *priv,
 				   u32 link_id_map)
 {
 	size_t ret;
-	int i, bit;
-	size_t map_capacity = queue->stats->map_capacity;
+	u32 map;
+	int i;
 
 	if (!link_id_map)
 		return 0;
 
 	spin_lock_bh(&queue->lock);
-	if (likely(link_id_map == (u32) -1)) {
+	map = queue->link_map[priv->if_id];
+	if (likely(!(map & ~link_id_map))) {
+		/* All non-empty links are requested. */
 		ret = queue->num_queued_vif[priv->if_id] -
 			queue->num_pending_vif[priv->if_id];
 	} else {
 		ret = 0;
-		for (i = 0, bit = 1; i < map_capacity; ++i, bit <<= 1) {
-			if (link_id_map & bit)
-				ret +=
-				queue->link_map_cache[priv->if_id][i];
+		map &= link_id_map;
+		while (map) {
+			i = __ffs(map);
+			map &= map - 1;
+			ret += queue->link_map_cache[priv->if_id][i];
 		}
 	}
 	spin_unlock_bh(&queue->lock);
 	return ret;
 }
 
-int xradio_queue_put(struct xradio_queue *queue, struct sk_buff *skb,
-                     struct xradio_txpriv *txpriv)
+/* Lockless snapshot of the requested links with frames queued; a hint
+ * only, xradio_queue_get() rechecks under the queue lock. */
+u32 xradio_queue_backlog(struct xradio_queue *queue, int if_id,
+                         u32 link_id_map)
+{
+	return READ_ONCE(queue->link_map[if_id]) & link_id_map;
+}
+
+/* Same for the links whose fast lane goes first. */
+u32 xradio_queue_fast_backlog(struct xradio_queue *queue, int if_id,
+                              u32 link_id_map)
+{
+	return READ_ONCE(queue->fast_map[if_id]) & link_id_map;
+}
+
+/* Data frames of a link dropped over their lifetime. */
+u32 xradio_queue_expired(struct xradio_queue *queue, int if_id, int link_id)
+{
+	return READ_ONCE(queue->link_queue[if_id][link_id].expired);
+}
+
+/* Free items a batch of xradio_queue_put_batch() may use, leaving the
+ * slots other CPUs calling xradio_queue_put() may need. */
+/* Dropped items leave num_queued at once but only return to the free
+ * pool with the gc, so count the free items themselves. */
+size_t xradio_queue_room(struct xradio_queue *queue)
+{
+	size_t reserve = num_present_cpus() - 1;
+	size_t free = READ_ONCE(queue->num_free);
+
+	return free > reserve ? free - reserve : 0;
+}
+
+/* TCP header of a queued pure ACK: no payload, no flags but ACK and no
+ * options but timestamps, so a newer ACK of the connection says all it
+ * does. *nh is the IPv4 or IPv6 header. */
+static struct tcphdr *
+__xradio_queue_tcp_ack(struct xradio_queue_item *item, u8 **nh)
+{
+	struct sk_buff *skb = item->skb;
+	struct ieee80211_tx_info *tx_info = IEEE80211_SKB_CB(skb);
+	struct ieee80211_hdr *hdr =
+		(struct ieee80211_hdr *)&skb->data[item->txpriv.offset];
+	u8 *end = skb->data + skb_headlen(skb);
+	u8 *llc, *opt, *opt_end;
+	struct tcphdr *th;
+	int len;
+
+	if (!ieee80211_is_data_present(hdr->frame_control))
+		return NULL;
+	if (ieee80211_is_data_qos(hdr->frame_control) &&
+	    (*ieee80211_get_qos_ctl(hdr) & IEEE80211_QOS_CTL_A_MSDU_PRESENT))
+		return NULL;
+	llc = (u8 *)hdr + ieee80211_hdrlen(hdr->frame_control);
+	if (ieee80211_has_protected(hdr->frame_control)) {
+		if (!tx_info->control.hw_key)
+			return NULL;
+		llc += tx_info->control.hw_key->iv_len;
+	}
+	if (llc + 8 + sizeof(struct iphdr) > end ||
+	    llc[0] != 0xAA || llc[1] != 0xAA || llc[2] != 0x03)
+		return NULL;
+
+	*nh = llc + 8;
+	if (*(__be16 *)(llc + 6) == htons(ETH_P_IP)) {
+		struct iphdr *iph = (struct iphdr *)*nh;
+
+		if (iph->version != 4 || iph->protocol != IPPROTO_TCP ||
+		    iph->ihl < 5 || (iph->frag_off & htons(IP_MF | IP_OFFSET)))
+			return NULL;
+		th = (struct tcphdr *)(*nh + iph->ihl * 4);
+		len = ntohs(iph->tot_len) - iph->ihl * 4;
+	} else if (*(__be16 *)(llc + 6) == htons(ETH_P_IPV6)) {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)*nh;
+
+		if ((u8 *)(ip6h + 1) > end ||
+		    ip6h->version != 6 || ip6h->nexthdr != IPPROTO_TCP)
+			return NULL;
+		th = (struct tcphdr *)(ip6h + 1);
+		len = ntohs(ip6h->payload_len);
+	} else {
+		return NULL;
+	}
+
+	if ((u8 *)(th + 1) > end || th->doff < 5 || len != th->doff * 4 ||
+	    (u8 *)th + th->doff * 4 > end)
+		return NULL;
+	if ((tcp_flag_word(th) & (TCP_FLAG_ACK | TCP_FLAG_SYN | TCP_FLAG_FIN |
+				  TCP_FLAG_RST | TCP_FLAG_URG | TCP_FLAG_ECE |
+				  TCP_FLAG_CWR)) != TCP_FLAG_ACK)
+		return NULL;
+
+	opt = (u8 *)(th + 1);
+	opt_end = (u8 *)th + th->doff * 4;
+	while (opt < opt_end && *opt != TCPOPT_EOL) {
+		if (*opt == TCPOPT_NOP) {
+			opt++;
+		} else if (*opt == TCPOPT_TIMESTAMP && opt + 1 < opt_end &&
+			   opt[1] == TCPOLEN_TIMESTAMP) {
+			opt += TCPOLEN_TIMESTAMP;
+		} else {
+			return NULL;	/* SACK and the like must get through */
+		}
+	}
+	return th;
+}
+
+static bool __xradio_queue_tcp_same(u8 *nh, struct tcphdr *th,
+				    u8 *old_nh, struct tcphdr *old_th)
+{
+	if (th->source != old_th->source || th->dest != old_th->dest)
+		return false;
+	if (((struct iphdr *)nh)->version == 4)
+		return ((struct iphdr *)old_nh)->version == 4 &&
+			((struct iphdr *)nh)->saddr ==
+				((struct iphdr *)old_nh)->saddr &&
+			((struct iphdr *)nh)->daddr ==
+				((struct iphdr *)old_nh)->daddr;
+	return ((struct ipv6hdr *)old_nh)->version == 6 &&
+		ipv6_addr_equal(&((struct ipv6hdr *)nh)->saddr,
+				&((struct ipv6hdr *)old_nh)->saddr) &&
+		ipv6_addr_equal(&((struct ipv6hdr *)nh)->daddr,
+				&((struct ipv6hdr *)old_nh)->daddr);
+}
+
+/* ACK filter as in CAKE: a queued pure ACK is dropped once a newer
+ * cumulative ACK of the same connection is queued behind it in its
+ * flow. Duplicate ACKs are kept for fast retransmit. Must be called
+ * with queue->lock held. */
+static void __xradio_queue_ack_filter(struct xradio_queue *queue,
+				      struct xradio_queue_item *item)
+{
+	struct xradio_queue_item *old, *tmp;
+	struct tcphdr *th, *old_th;
+	u8 *nh, *old_nh;
+
+	th = __xradio_queue_tcp_ack(item, &nh);
+	if (!th)
+		return;
+
+	list_for_each_entry_safe(old, tmp, &item->flow->items, link) {
+		if (old == item)
+			break;
+		if (old->expired)
+			continue;
+		old_th = __xradio_queue_tcp_ack(old, &old_nh);
+		if (!old_th || !__xradio_queue_tcp_same(nh, th, old_nh, old_th) ||
+		    !after(ntohl(th->ack_seq), ntohl(old_th->ack_seq)))
+			continue;
+		__xradio_queue_discard(queue, old);
+		++queue->num_ack_drops;
+	}
+}
+
+/* Must be called with queue->lock and stats->lock held. */
+static int __xradio_queue_put(struct xradio_queue *queue, struct sk_buff *skb,
+                              struct xradio_txpriv *txpriv)
 {
-	int ret = 0;
 #ifdef CONFIG_XRADIO_TESTMODE
 	struct timeval tmval;
 #endif /*CONFIG_XRADIO_TESTMODE*/
-	LIST_HEAD(gc_list);
-	struct xradio_queue_stats *stats = queue->stats;
-	/* TODO:COMBO: Add interface ID info to queue item */
-
-	if (txpriv->link_id >= queue->stats->map_capacity)
-		return -EINVAL;
+	struct xradio_queue_item *item;
 
-	spin_lock_bh(&queue->lock);
-	if (!SYS_WARN(list_empty(&queue->free_pool))) {
-		struct xradio_queue_item *item = list_first_entry(
-			&queue->free_pool, struct xradio_queue_item, head);
-		SYS_BUG(item->skb);
-
-		list_move_tail(&item->head, &queue->queue);
-		item->skb = skb;
-		item->txpriv = *txpriv;
-		item->generation  = 1; /* avoid packet ID is 0.*/
-		item->pack_stk_wr = 0;
-		item->packetID = xradio_queue_make_packet_id(
-			queue->generation, queue->queue_id,
-			item->generation, item - queue->pool,
-			txpriv->if_id, txpriv->raw_link_id);
-		item->queue_timestamp = jiffies;
+	if (SYS_WARN(list_empty(&queue->free_pool)))
+		return -ENOENT;
+
+	item = list_first_entry(&queue->free_pool,
+				struct xradio_queue_item, head);
+	SYS_BUG(item->skb);
+
+	list_move_tail(&item->head, &queue->queue);
+	--queue->num_free;
+	item->skb = skb;
+	item->txpriv = *txpriv;
+	item->len = skb->len;
+	item->flow = __xradio_queue_flow_hash(queue, skb, txpriv);
+	__xradio_queue_link_add(queue, item, false);
+	item->generation  = 1; /* avoid packet ID is 0.*/
+	item->pack_stk_wr = 0;
+	item->expired     = 0;
+	item->packetID = xradio_queue_make_packet_id(
+		queue->generation, queue->queue_id,
+		item->generation, item - queue->pool,
+		txpriv->if_id, txpriv->raw_link_id);
+	item->queue_timestamp = jiffies;
 #ifdef CONFIG_XRADIO_TESTMODE
-		do_gettimeofday(&tmval);
-		item->qdelay_timestamp = tmval.tv_usec;
+	do_gettimeofday(&tmval);
+	item->qdelay_timestamp = tmval.tv_usec;
 #endif /*CONFIG_XRADIO_TESTMODE*/
 
 #ifdef TES_P2P_0002_ROC_RESTART
-		if (TES_P2P_0002_state == TES_P2P_0002_STATE_SEND_RESP) {
-			TES_P2P_0002_packet_id = item->packetID;
-			TES_P2P_0002_state = TES_P2P_0002_STATE_GET_PKTID;
-			txrx_printk(XRADIO_DBG_WARN, "[ROC_RESTART_STATE_GET_PKTID]\n");
-		}
+	if (TES_P2P_0002_state == TES_P2P_0002_STATE_SEND_RESP) {
+		TES_P2P_0002_packet_id = item->packetID;
+		TES_P2P_0002_state = TES_P2P_0002_STATE_GET_PKTID;
+		txrx_printk(XRADIO_DBG_WARN, "[ROC_RESTART_STATE_GET_PKTID]\n");
+	}
 #endif
 
-		++queue->num_queued;
-		++queue->num_queued_vif[txpriv->if_id];
-		++queue->link_map_cache[txpriv->if_id][txpriv->link_id];
+	++queue->num_queued;
+	++queue->num_queued_vif[txpriv->if_id];
+	++queue->link_map_cache[txpriv->if_id][txpriv->link_id];
+	queue->bytes_queued_vif[txpriv->if_id] += item->len;
+	__xradio_queue_stats_inc(queue->stats, txpriv->if_id, txpriv->link_id);
+	return 0;
+}
 
-		spin_lock_bh(&stats->lock);
-		++stats->num_queued[txpriv->if_id];
-		++stats->link_map_cache[txpriv->if_id][txpriv->link_id];
-		spin_unlock_bh(&stats->lock);
+int xradio_queue_put(struct xradio_queue *queue, struct sk_buff *skb,
+                     struct xradio_txpriv *txpriv)
+{
+	int ret = xradio_queue_put_batch(queue, &skb, txpriv, 1);
+
+	if (ret < 0)
+		return ret;
+	return ret ? 0 : -ENOENT;
+}
+
+/* Queue @count frames of one interface under a single lock round.
+ * Returns the number of frames queued, the first ones of the batch. */
+int xradio_queue_put_batch(struct xradio_queue *queue, struct sk_buff **skb,
+                           struct xradio_txpriv *txpriv, int count)
+{
+	struct xradio_queue_stats *stats = queue->stats;
+	int i;
+	/* TODO:COMBO: Add interface ID info to queue item */
+
+	for (i = 0; i < count; i++) {
+		if (txpriv[i].link_id >= stats->map_capacity)
+			return -EINVAL;
+	}
+
+	spin_lock_bh(&queue->lock);
+	spin_lock_bh(&stats->lock);
+	for (i = 0; i < count; i++) {
+		if (__xradio_queue_put(queue, skb[i], &txpriv[i]))
+			break;
+	}
+	spin_unlock_bh(&stats->lock);
+
+	if (i && stats->hw_priv->tcp_ack_filter) {
+		struct xradio_queue_item *item =
+			list_last_entry(&queue->queue,
+					struct xradio_queue_item, head);
+		int j;
+
+		/* Oldest of the batch first, filtering only drops frames
+		 * queued before the one looked at. */
+		for (j = 1; j < i; j++)
+			item = list_prev_entry(item, head);
+		for (j = 0; j < i; j++) {
+			struct xradio_queue_item *next =
+				list_next_entry(item, head);
+
+			__xradio_queue_ack_filter(queue, item);
+			item = next;
+		}
+	}
+
+	if (i) {
+		__xradio_queue_bql_update(queue, txpriv[0].if_id);
 
 		/*
+		 * The byte limits above normally stop the VIF long before
+		 * the pool runs out, this only guards the item pool.
 		 * TX may happen in parallel sometimes.
 		 * Leave extra queue slots so we don't overflow.
 		 */
 		if (queue->overfull == false &&
 				queue->num_queued >=
-		((stats->hw_priv->vif0_throttle +stats->hw_priv->vif1_throttle)
-				- (num_present_cpus() - 1))) {
+				(queue->capacity - (num_present_cpus() - 1))) {
 			queue->overfull = true;
 			__xradio_queue_lock(queue);
 			mod_timer(&queue->gc, jiffies);
 			txrx_printk(XRADIO_DBG_NIY,"!lock queue\n");
 		}
-	} else {
-		ret = -ENOENT;
 	}
 #if 0
 	txrx_printk(XRADIO_DBG_ERROR, "queue_put queue %d, %d, %d\n",
@@ -439,7 +1326,7 @@ int xradio_queue_put(struct xradio_queue *queue, struct sk_buff *skb,
 		stats->link_map_cache[txpriv->if_id][txpriv->link_id]);
 #endif
 	spin_unlock_bh(&queue->lock);
-	return ret;
+	return i;
 }
 
 int xradio_queue_get(struct xradio_queue *queue,
@@ -453,29 +1340,48 @@ int xradio_queue_get(struct xradio_queue *queue,
 	struct xradio_queue_item *item;
 	struct xradio_queue_stats *stats = queue->stats;
 	bool wakeup_stats = false;
+	bool held = false;
+	size_t drops;
 #ifdef CONFIG_XRADIO_TESTMODE
 	struct timeval tmval;
 #endif /*CONFIG_XRADIO_TESTMODE*/
 
 	spin_lock_bh(&queue->lock);
-	list_for_each_entry(item, &queue->queue, head) {
-		if ((item->txpriv.if_id == if_id) &&
-			(link_id_map & BIT(item->txpriv.link_id))) {
-			ret = 0;
-			break;
-		}
-	}
+	drops = queue->num_fq_drops + queue->num_expired;
+	item = __xradio_queue_link_first(queue, if_id, link_id_map, &held);
+	if (item)
+		ret = 0;
+	else
+		SYS_WARN(!held &&
+			 queue->num_fq_drops + queue->num_expired == drops);
+
+	if (!ret) {
+		unsigned long lifetime = __xradio_queue_lifetime(queue, item);
 
-	if (!SYS_WARN(ret)) {
 		*tx = (struct wsm_tx *)item->skb->data;
 		*tx_info = IEEE80211_SKB_CB(item->skb);
 		*txpriv = &item->txpriv;
 		(*tx)->packetID = __cpu_to_le32(item->packetID);
+		/* The firmware drops it too once the rest runs out. */
+		if (item->expired) {
+			(*tx)->flags |= WSM_TX_FLAG_EXPIRY_TIME;
+			(*tx)->expireTime = __cpu_to_le32(1);
+		} else if (lifetime) {
+			long left = (long)(item->queue_timestamp + lifetime -
+					   jiffies);
+
+			(*tx)->flags |= WSM_TX_FLAG_EXPIRY_TIME;
+			(*tx)->expireTime = __cpu_to_le32(max_t(u32, 1,
+				left > 0 ? jiffies_to_usecs(left) / 1024 : 0));
+		}
+		__xradio_queue_link_del(queue, item);
 		list_move_tail(&item->head, &queue->pending);
 		++queue->num_pending;
 		++queue->num_pending_vif[item->txpriv.if_id];
 		--queue->link_map_cache[item->txpriv.if_id]
 				[item->txpriv.link_id];
+		queue->bytes_queued_vif[item->txpriv.if_id] -= item->len;
+		__xradio_queue_bql_update(queue, item->txpriv.if_id);
 		item->xmit_timestamp = jiffies;
 #ifdef CONFIG_XRADIO_TESTMODE
 		do_gettimeofday(&tmval);
@@ -483,9 +1389,9 @@ int xradio_queue_get(struct xradio_queue *queue,
 #endif /*CONFIG_XRADIO_TESTMODE*/
 
 		spin_lock_bh(&stats->lock);
-		--stats->num_queued[item->txpriv.if_id];
-		if (!--stats->link_map_cache[item->txpriv.if_id]
-					[item->txpriv.link_id])
+		list_add_tail(&item->link, &stats->pending[item->txpriv.if_id]);
+		if (__xradio_queue_stats_dec(stats, item->txpriv.if_id,
+					     item->txpriv.link_id))
 			wakeup_stats = true;
 
 		spin_unlock_bh(&stats->lock);
@@ -558,10 +1464,13 @@ int xradio_queue_requeue(struct xradio_queue *queue, u32 packetID, bool check)
 		--queue->num_pending;
 		--queue->num_pending_vif[if_id];
 		++queue->link_map_cache[if_id][item->txpriv.link_id];
+		queue->bytes_queued_vif[if_id] += item->len;
+		__xradio_queue_bql_update(queue, if_id);
 
 		spin_lock_bh(&stats->lock);
-		++stats->num_queued[item->txpriv.if_id];
-		++stats->link_map_cache[if_id][item->txpriv.link_id];
+		list_del(&item->link);
+		__xradio_queue_stats_inc(stats, item->txpriv.if_id,
+					 item->txpriv.link_id);
 		spin_unlock_bh(&stats->lock);
 
 		item->generation = ++item_generation;
@@ -569,6 +1478,7 @@ int xradio_queue_requeue(struct xradio_queue *queue, u32 packetID, bool check)
 			queue_generation, queue_id, item_generation, item_id,
 			if_id, link_id);
 		list_move(&item->head, &queue->queue);
+		__xradio_queue_link_add(queue, item, true);
 #if 0
 		txrx_printk(XRADIO_DBG_ERROR, "queue_requeue queue %d, %d, %d\n",
 		queue->num_queued,
@@ -586,6 +1496,7 @@ int xradio_queue_requeue(struct xradio_queue *queue, u32 packetID, bool check)
 int xradio_queue_requeue_all(struct xradio_queue *queue)
 {
 	struct xradio_queue_stats *stats = queue->stats;
+	int i;
 	spin_lock_bh(&queue->lock);
 	while (!list_empty(&queue->pending)) {
 		struct xradio_queue_item *item = list_entry(
@@ -595,11 +1506,12 @@ int xradio_queue_requeue_all(struct xradio_queue *queue)
 		--queue->num_pending_vif[item->txpriv.if_id];
 		++queue->link_map_cache[item->txpriv.if_id]
 				[item->txpriv.link_id];
+		queue->bytes_queued_vif[item->txpriv.if_id] += item->len;
 
 		spin_lock_bh(&stats->lock);
-		++stats->num_queued[item->txpriv.if_id];
-		++stats->link_map_cache[item->txpriv.if_id]
-				[item->txpriv.link_id];
+		list_del(&item->link);
+		__xradio_queue_stats_inc(stats, item->txpriv.if_id,
+					 item->txpriv.link_id);
 		spin_unlock_bh(&stats->lock);
 
 		++item->generation;
@@ -608,7 +1520,10 @@ int xradio_queue_requeue_all(struct xradio_queue *queue)
 			item->generation, item - queue->pool,
 			item->txpriv.if_id, item->txpriv.raw_link_id);
 		list_move(&item->head, &queue->queue);
+		__xradio_queue_link_add(queue, item, true);
 	}
+	for (i = 0; i < XRWL_MAX_VIFS; i++)
+		__xradio_queue_bql_update(queue, i);
 	spin_unlock_bh(&queue->lock);
 
 	return 0;
@@ -653,6 +1568,7 @@ int xradio_queue_remove(struct xradio_queue *queue, u32 packetID)
 		--queue->num_queued_vif[if_id];
 		++queue->num_sent;
 		++item->generation;
+		__xradio_queue_bql_complete(queue, if_id, item->len);
 #ifdef CONFIG_XRADIO_TESTMODE
 		spin_lock_bh(&hw_priv->tsm_lock);
 		if (hw_priv->start_stop_tsm.start) {
@@ -693,10 +1609,14 @@ int xradio_queue_remove(struct xradio_queue *queue, u32 packetID)
 		/* Do not use list_move_tail here, but list_move:
 		 * try to utilize cache row.
 		 */
+		spin_lock_bh(&stats->lock);
+		list_del(&item->link);
+		spin_unlock_bh(&stats->lock);
 		list_move(&item->head, &queue->free_pool);
+		++queue->num_free;
 
 		if (unlikely(queue->overfull) &&
-		    (queue->num_queued <= ((stats->hw_priv->vif0_throttle + stats->hw_priv->vif1_throttle + 2)>>1))) {
+		    (queue->num_queued <= (queue->capacity >> 1))) {
 			queue->overfull = false;
 			__xradio_queue_unlock(queue);
 		}
@@ -762,6 +1682,35 @@ void xradio_queue_unlock(struct xradio_queue *queue)
 	spin_unlock_bh(&queue->lock);
 }
 
+/* Drop all locks of the queue, returns true if it was locked. */
+bool xradio_queue_reset_lock(struct xradio_queue *queue)
+{
+	bool locked;
+	int i;
+
+	spin_lock_bh(&queue->lock);
+	locked = queue->tx_locked_cnt > 0;
+	if (locked) {
+		queue->tx_locked_cnt = 0;
+		queue->overfull = false;
+		for (i = 0; i < XRWL_MAX_VIFS; i++)
+			__xradio_queue_hw_update(queue, i);
+		__xradio_queue_shared_update(queue, false);
+	}
+	spin_unlock_bh(&queue->lock);
+	return locked;
+}
+
+bool xradio_queue_stopped(struct xradio_queue *queue, int if_id)
+{
+	bool stopped;
+
+	spin_lock_bh(&queue->lock);
+	stopped = !!(queue->hw_stopped & BIT(if_id));
+	spin_unlock_bh(&queue->lock);
+	return stopped;
+}
+
 bool xradio_queue_get_xmit_timestamp(struct xradio_queue *queue,
 				     unsigned long *timestamp, int if_id,
 				     u32 pending_frameID, u32 *Old_frame_ID)
@@ -771,18 +1720,15 @@ bool xradio_queue_get_xmit_timestamp(struct xradio_queue *queue,
 
 	spin_lock_bh(&queue->lock);
 	ret = !list_empty(&queue->pending);
-	if (ret) {
-		list_for_each_entry(item, &queue->pending, head) {
-			if (((if_id == XRWL_GENERIC_IF_ID) ||
-				(if_id == XRWL_ALL_IFS) ||
-					(item->txpriv.if_id == if_id)) &&
-					(item->packetID != pending_frameID)) {
-				if (time_before(item->xmit_timestamp,
-							*timestamp)) {
-					*timestamp = item->xmit_timestamp;
-					*Old_frame_ID = item->packetID;
-				}
+	list_for_each_entry(item, &queue->pending, head) {
+		if ((if_id == XRWL_GENERIC_IF_ID || if_id == XRWL_ALL_IFS ||
+		     item->txpriv.if_id == if_id) &&
+		    item->packetID != pending_frameID) {
+			if (time_before(item->xmit_timestamp, *timestamp)) {
+				*timestamp = item->xmit_timestamp;
+				*Old_frame_ID = item->packetID;
 			}
+			break;
 		}
 	}
 	spin_unlock_bh(&queue->lock);
@@ -798,15 +1744,11 @@ bool xradio_queue_stats_is_empty(struct xradio_queue_stats *stats,
 	if (link_id_map == (u32)-1)
 		empty = stats->num_queued[if_id] == 0;
 	else {
-		int i, if_id;
-		for (if_id = 0; if_id < XRWL_MAX_VIFS; if_id++) {
-			for (i = 0; i < stats->map_capacity; ++i) {
-				if (link_id_map & BIT(i)) {
-					if (stats->link_map_cache[if_id][i]) {
-						empty = false;
-						break;
-					}
-				}
+		int i;
+		for (i = 0; i < XRWL_MAX_VIFS; i++) {
+			if (stats->link_map[i] & link_id_map) {
+				empty = false;
+				break;
 			}
 		}
 	}
@@ -815,55 +1757,43 @@ bool xradio_queue_stats_is_empty(struct xradio_queue_stats *stats,
 	return empty;
 }
 
+/* Takes no queue lock: pending frames of all queues are on
+ * stats->pending and can't leave it while stats->lock is held. */
 bool xradio_query_txpkt_timeout(struct xradio_common *hw_priv, int if_id,
                                 u32 pending_pkt_id, long *timeout)
 {
 	int i;
 	bool pending = false;
 	unsigned long timestamp = jiffies;
-	struct xradio_queue      *queue = NULL;
-	struct xradio_queue_item *item  = NULL;
-	struct xradio_queue      *old_queue = NULL;
-	struct xradio_queue_item *old_item  = NULL;
+	struct xradio_queue_stats *stats = &hw_priv->tx_queue_stats;
+	struct xradio_queue_item *old_item;
+	struct ieee80211_hdr *frame = NULL;
+	const struct xradio_txpriv *txpriv = NULL;
+	u16 fctl = 0x0;
+	u32 len  = 0x0;
+	u8 link_id = 0, tid = 0;
 	u8 pack_stk_wr = 0;
 
+	spin_lock_bh(&stats->lock);
+	for (i = 0; i < XRWL_MAX_VIFS; ++i)
+		pending |= !list_empty(&stats->pending[i]);
+	if (!pending) {
+		spin_unlock_bh(&stats->lock);
+		return false;
+	}
+
 	/* Get oldest frame.*/
-	for (i = 0; i < AC_QUEUE_NUM; ++i) {
-		queue = &hw_priv->tx_queue[i];
-		spin_lock_bh(&queue->lock);
-		if (!list_empty(&queue->pending)) {
-			list_for_each_entry(item, &queue->pending, head) {
-				if (((if_id == XRWL_GENERIC_IF_ID) ||
-					 (if_id == XRWL_ALL_IFS) ||
-					 (item->txpriv.if_id == if_id)) &&
-					 (item->packetID != pending_pkt_id)) {
-					if (time_before(item->xmit_timestamp, timestamp)) {
-						timestamp   = item->xmit_timestamp;
-						pack_stk_wr = item->pack_stk_wr;
-						old_queue   = queue;
-						old_item    = item;
-					}
-				}
-			}
-			pending = true;
-		}
-		spin_unlock_bh(&queue->lock);
+	old_item = __xradio_queue_oldest_pending(stats, if_id, pending_pkt_id);
+	if (old_item && time_before(old_item->xmit_timestamp, timestamp)) {
+		timestamp   = old_item->xmit_timestamp;
+		pack_stk_wr = old_item->pack_stk_wr;
 	}
-	if (!pending)
-		return false;
 
 	/* Check if frame transmission is timed out.
 	 * add (WSM_CMD_LAST_CHANCE_TIMEOUT>>1) for stuck workaround.*/
 	*timeout = timestamp + WSM_CMD_LAST_CHANCE_TIMEOUT - jiffies;
 	if (unlikely(*timeout < 0) && !pack_stk_wr) {
-		struct ieee80211_hdr *frame = NULL;
-		const struct xradio_txpriv *txpriv = NULL;
-		u16 fctl = 0x0;
-		u32 len  = 0x0;
-		u8 if_id = 0, link_id = 0, tid = 0;
-
 		/* query the timeout frame. */
-		spin_lock_bh(&old_queue->lock);
 		if (likely(old_item->skb && !hw_priv->query_packetID)) {
 			hw_priv->query_packetID = old_item->packetID;
 			old_item->pack_stk_wr = 1;
@@ -878,7 +1808,7 @@ bool xradio_query_txpkt_timeout(struct xradio_common *hw_priv, int if_id,
 			link_id = txpriv->link_id;
 			tid = txpriv->tid;
 		}
-		spin_unlock_bh(&old_queue->lock);
+		spin_unlock_bh(&stats->lock);
 		/* Dump Info of stuck frames. */
 		if (frame) {
 			txrx_printk(XRADIO_DBG_ERROR, "TX confirm timeout(%ds).\n", 
@@ -890,9 +1820,12 @@ bool xradio_query_txpkt_timeout(struct xradio_common *hw_priv, int if_id,
 		}
 		/* Return half of timeout for query packet. */
 		*timeout = (WSM_CMD_LAST_CHANCE_TIMEOUT>>1);
-	} else if (unlikely(pack_stk_wr)){
-		*timeout = *timeout + (WSM_CMD_LAST_CHANCE_TIMEOUT>>1);
-		txrx_printk(XRADIO_DBG_MSG,"%s, wr and timeout=%ld\n", __func__, *timeout);
+	} else {
+		spin_unlock_bh(&stats->lock);
+		if (unlikely(pack_stk_wr)) {
+			*timeout = *timeout + (WSM_CMD_LAST_CHANCE_TIMEOUT>>1);
+			txrx_printk(XRADIO_DBG_MSG,"%s, wr and timeout=%ld\n", __func__, *timeout);
+		}
 	}
 	return pending;
 }
@@ -14,6 +14,8 @@
 #define XRADIO_QUEUE_H_INCLUDED
 
 /* private */ struct xradio_queue_item;
+/* private */ struct xradio_queue_flow;
+/* private */ struct xradio_queue_link;
 
 /* extern */ struct sk_buff;
 /* extern */ struct wsm_tx;
@@ -37,9 +39,26 @@ struct xradio_queue {
 	size_t                    num_pending_vif[XRWL_MAX_VIFS];
 	size_t                    num_sent;
 	struct xradio_queue_item *pool;
-	struct list_head          queue;
+	struct list_head          queue;     /* all queued items, oldest first */
 	struct list_head          free_pool;
-	struct list_head          pending;
+	size_t                    num_free;  /* items on free_pool */
+	struct list_head          pending;   /* in xmit order */
+	struct xradio_queue_link *link_queue[XRWL_MAX_VIFS]; /* per-link flows */
+	struct xradio_queue_flow *flows;     /* hashed flows of all links */
+	struct list_head          drop_list; /* CoDel drops, freed by gc */
+	size_t                    num_fq_drops;
+	size_t                    num_expired; /* over their lifetime */
+	size_t                    num_ack_drops; /* superseded TCP ACKs */
+	u32                       link_map[XRWL_MAX_VIFS];   /* non-empty FIFOs */
+	u32                       fast_map[XRWL_MAX_VIFS];   /* fast lane first */
+	size_t                    num_fast;  /* fast lane frames queued */
+	u8                        link_rr[XRWL_MAX_VIFS];    /* last link served */
+	size_t                    bytes_queued_vif[XRWL_MAX_VIFS]; /* not sent */
+	size_t                    bql_limit[XRWL_MAX_VIFS];
+	size_t                    bql_completed[XRWL_MAX_VIFS];
+	unsigned long             bql_stamp[XRWL_MAX_VIFS];
+	u32                       bql_stopped;  /* VIFs over their limit */
+	u32                       hw_stopped;   /* VIFs with hw queue stopped */
 	int                       tx_locked_cnt;
 	int                      *link_map_cache[XRWL_MAX_VIFS];
 	bool                      overfull;
@@ -48,13 +67,18 @@ struct xradio_queue {
 	u8                        generation;
 	struct timer_list	        gc;
 	unsigned long             ttl;
+	unsigned long             lifetime;  /* of data frames, 0 for none */
 };
 
 struct xradio_queue_stats {
 	spinlock_t              lock;
 	int                    *link_map_cache[XRWL_MAX_VIFS];
+	u32                     link_map[XRWL_MAX_VIFS];  /* non-zero cache entries */
 	int                     num_queued[XRWL_MAX_VIFS];
+	u32                     locked_map;  /* locked queues, stops shared hw queue */
 	size_t                  map_capacity;
+	/* Pending items of all queues per VIF, in xmit order */
+	struct list_head        pending[XRWL_MAX_VIFS];
 	wait_queue_head_t       wait_link_id_empty;
 	xradio_queue_skb_dtor_t skb_dtor;
 	struct xradio_common   *hw_priv;
@@ -73,6 +97,8 @@ struct xradio_txpriv {
 	u8 raw_if_id;
 #endif
 	u8 use_bg_rate;
+	u8 fast_lane;	/* XRADIO_FAST_LANE_* class, served first */
+	u16 airtime;	/* estimate in us, see xradio_airtime */
 };
 
 int xradio_queue_stats_init(struct xradio_queue_stats *stats,
@@ -91,8 +117,16 @@ void xradio_queue_deinit(struct xradio_queue *queue);
 size_t xradio_queue_get_num_queued(struct xradio_vif *priv,
                                    struct xradio_queue *queue,
                                    u32 link_id_map);
+u32 xradio_queue_backlog(struct xradio_queue *queue, int if_id,
+                         u32 link_id_map);
+u32 xradio_queue_expired(struct xradio_queue *queue, int if_id, int link_id);
+u32 xradio_queue_fast_backlog(struct xradio_queue *queue, int if_id,
+                              u32 link_id_map);
 int xradio_queue_put(struct xradio_queue *queue,
                      struct sk_buff *skb, struct xradio_txpriv *txpriv);
+int xradio_queue_put_batch(struct xradio_queue *queue, struct sk_buff **skb,
+                           struct xradio_txpriv *txpriv, int count);
+size_t xradio_queue_room(struct xradio_queue *queue);
 int xradio_queue_get(struct xradio_queue *queue,
                      int if_id, u32 link_id_map,
                      struct wsm_tx **tx,
@@ -120,6 +154,8 @@ int xradio_queue_get_skb(struct xradio_queue *queue, u32 packetID,
                          const struct xradio_txpriv **txpriv);
 void xradio_queue_lock(struct xradio_queue *queue);
 void xradio_queue_unlock(struct xradio_queue *queue);
+bool xradio_queue_reset_lock(struct xradio_queue *queue);
+bool xradio_queue_stopped(struct xradio_queue *queue, int if_id);
 bool xradio_queue_get_xmit_timestamp(struct xradio_queue *queue,
                                      unsigned long *timestamp, int if_id,
                                      u32 pending_frameID, u32 *Old_frame_ID);
@@ -233,8 +233,8 @@ int xradio_add_interface(struct ieee80211_hw *dev,
 	struct xradio_common *hw_priv = dev->priv;
 	struct xradio_vif *priv;
 	struct xradio_vif **drv_priv = (void *)vif->drv_priv;
-#ifndef P2P_MULTIVIF
 	int i;
+#ifndef P2P_MULTIVIF
 	if (atomic_read(&hw_priv->num_vifs) >= XRWL_MAX_VIFS)
 		return -EOPNOTSUPP;
 #endif
@@ -299,6 +299,12 @@ int xradio_add_interface(struct ieee80211_hw *dev,
 	/* TODO:COMBO :Check if MAC address matches the one expected by FW */
 	memcpy(hw_priv->mac_addr, vif->addr, ETH_ALEN);
 
+	/* Each VIF owns its hw queues, so one can be stopped alone. */
+	for (i = 0; i < AC_QUEUE_NUM; ++i)
+		vif->hw_queue[i] = xradio_hw_queue(priv->if_id, i);
+	vif->cab_queue = XRWL_SHARED_HW_QUEUE;
+	xradio_txq_init(vif->txq);
+
 	/* Enable auto-calibration */
 	/* Exception in subsequent channel switch; disabled.
 	SYS_WARN(wsm_write_mib(hw_priv, WSM_MIB_ID_SET_AUTO_CALIBRATION_MODE,
@@ -324,14 +330,13 @@ void xradio_remove_interface(struct ieee80211_hw *dev,
 		.reset_statistics = true,
 	};
 	int i;
-	bool is_htcapie = false;
-	struct xradio_vif *tmp_priv;
 	struct wsm_operational_mode mode = {
 		.power_mode = wsm_power_mode_quiescent,
 		.disableMoreFlagUsage = true,
 	};
 	sta_printk(XRADIO_DBG_WARN, "!!! %s: vif_id=%d\n", __func__, priv->if_id);
 	atomic_set(&priv->enabled, 0);
+	xradio_txq_unlink(hw_priv, vif->txq);
 	down(&hw_priv->scan.lock);
 	if(priv->join_status == XRADIO_JOIN_STATUS_STA){
 		if (atomic_xchg(&priv->delayed_unjoin, 0)) {
@@ -364,26 +369,6 @@ void xradio_remove_interface(struct ieee80211_hw *dev,
 		reset.link_id = 0;
 		wsm_reset(hw_priv, &reset, priv->if_id);
 		SYS_WARN(wsm_set_operational_mode(hw_priv, &mode, priv->if_id));
-		xradio_for_each_vif(hw_priv, tmp_priv, i) {
-#ifdef P2P_MULTIVIF
-			if ((i == (XRWL_MAX_VIFS - 1)) || !tmp_priv)
-#else
-			if (!tmp_priv)
-#endif
-				continue;
-			if ((tmp_priv->join_status == XRADIO_JOIN_STATUS_STA) && tmp_priv->htcap)
-				is_htcapie = true;
-		}
-
-		if (is_htcapie) {
-			hw_priv->vif0_throttle = XRWL_HOST_VIF0_11N_THROTTLE;
-			hw_priv->vif1_throttle = XRWL_HOST_VIF1_11N_THROTTLE;
-			sta_printk(XRADIO_DBG_NIY, "AP REMOVE HTCAP 11N %d\n",hw_priv->vif0_throttle);
-		} else {
-			hw_priv->vif0_throttle = XRWL_HOST_VIF0_11BG_THROTTLE;
-			hw_priv->vif1_throttle = XRWL_HOST_VIF1_11BG_THROTTLE;
-			sta_printk(XRADIO_DBG_NIY, "AP REMOVE 11BG %d\n",hw_priv->vif0_throttle);
-		}
 		break;
 	case XRADIO_JOIN_STATUS_MONITOR:
 		xradio_disable_listening(priv);
@@ -426,6 +411,17 @@ void xradio_remove_interface(struct ieee80211_hw *dev,
 	spin_unlock(&hw_priv->vif_list_lock);
 	priv->listening = false;
 
+	/* xradio_ba_timer() may still be walking this vif; wait for it,
+	 * later runs no longer see it in vif_list. The same goes for TX
+	 * confirms and debugfs queueing rts_work. */
+	del_timer_sync(&hw_priv->ba_timer);
+	cancel_work_sync(&priv->rts_work);
+	spin_lock_bh(&hw_priv->ba_lock);
+	if (hw_priv->ba_ena)
+		mod_timer(&hw_priv->ba_timer,
+			  jiffies + XRADIO_BLOCK_ACK_INTERVAL);
+	spin_unlock_bh(&hw_priv->ba_lock);
+
 	xradio_debug_release_priv(priv);
 
 	xradio_tx_queues_unlock(hw_priv);
@@ -777,6 +773,19 @@ void xradio_configure_filter(struct ieee80211_hw *hw,
 	}
 }
 
+/* dot11MaxTransmitMsduLifetime of a queue, the per frame expiry time
+ * overrides it for data frames, see xradio_queue_get(). */
+int xradio_set_tx_lifetime(struct xradio_vif *priv, int queue)
+{
+	struct xradio_common *hw_priv = priv->hw_priv;
+
+	WSM_TX_QUEUE_SET(&priv->tx_queue_params, queue, 0, 0,
+		jiffies_to_usecs(hw_priv->tx_queue[queue].lifetime) / 1024);
+	return wsm_set_tx_queue_params(hw_priv,
+	                               &priv->tx_queue_params.params[queue],
+	                               queue, priv->if_id);
+}
+
 int xradio_conf_tx(struct ieee80211_hw *dev, struct ieee80211_vif *vif,
                    u16 queue, const struct ieee80211_tx_queue_params *params)
 {
@@ -800,10 +809,7 @@ int xradio_conf_tx(struct ieee80211_hw *dev, struct ieee80211_vif *vif,
 	if (queue < dev->queues) {
 		old_uapsdFlags = priv->uapsd_info.uapsdFlags;
 
-		WSM_TX_QUEUE_SET(&priv->tx_queue_params, queue, 0, 0, 0);
-		ret = wsm_set_tx_queue_params(hw_priv,
-		                              &priv->tx_queue_params.params[queue],
-		                              queue, priv->if_id);
+		ret = xradio_set_tx_lifetime(priv, queue);
 		if (ret) {
 			sta_printk(XRADIO_DBG_ERROR,"%s:wsm_set_tx_queue_params failed!\n", __func__);
 			ret = -EINVAL;
@@ -928,7 +934,10 @@ int xradio_set_key(struct ieee80211_hw *dev, enum set_key_cmd cmd,
 		if (sta)
 			peer_addr = sta->addr;
 
-		key->flags |= IEEE80211_KEY_FLAG_PUT_IV_SPACE;
+		/* Let mac80211 leave room for IV and ICV/MIC, so that
+		 * xradio_tx_h_crypt() never has to move the frame. */
+		key->flags |= IEEE80211_KEY_FLAG_PUT_IV_SPACE |
+			      IEEE80211_KEY_FLAG_RESERVE_TAILROOM;
 
 		priv->cipherType = key->cipher;
 		switch (key->cipher) {
@@ -1029,6 +1038,9 @@ int xradio_set_key(struct ieee80211_hw *dev, enum set_key_cmd cmd,
 			key->hw_key_idx = idx;
 		else
 			xradio_free_key(hw_priv, idx);
+		if (!ret && pairwise)
+			WRITE_ONCE(((struct xradio_sta_priv *)
+				    &sta->drv_priv)->ptk, key);
 
 		if (!ret && (pairwise || wsm_key->type == WSM_KEY_TYPE_WEP_DEFAULT) && 
 		    (priv->filter4.enable & 0x2))
@@ -1049,6 +1061,9 @@ int xradio_set_key(struct ieee80211_hw *dev, enum set_key_cmd cmd,
 			goto finally;
 		}
 
+		if (sta && (key->flags & IEEE80211_KEY_FLAG_PAIRWISE))
+			WRITE_ONCE(((struct xradio_sta_priv *)
+				    &sta->drv_priv)->ptk, NULL);
 		xradio_free_key(hw_priv, wsm_key.entryIndex);
 		ret = wsm_remove_key(hw_priv, &wsm_key, priv->if_id);
 	} else {
@@ -1056,6 +1071,7 @@ int xradio_set_key(struct ieee80211_hw *dev, enum set_key_cmd cmd,
 	}
 
 finally:
+	xradio_tx_desc_flush(hw_priv);
 	mutex_unlock(&hw_priv->conf_mutex);
 	return ret;
 }
@@ -1087,32 +1103,61 @@ void xradio_wep_key_work(struct work_struct *work)
 	wsm_unlock_tx(hw_priv);
 }
 
+/* The threshold is mac80211's, lowered to XRADIO_RTS_THRESHOLD while
+ * dynamic RTS is on. */
+static int __xradio_rts_apply(struct xradio_vif *priv)
+{
+	struct xradio_common *hw_priv = priv->hw_priv;
+	u32 threshold = hw_priv->rts_threshold;
+	__le32 val32;
+	int ret;
+
+	if (READ_ONCE(priv->rts.enabled) &&
+	    (!threshold || threshold > XRADIO_RTS_THRESHOLD))
+		threshold = XRADIO_RTS_THRESHOLD;
+
+	val32 = __cpu_to_le32(threshold);
+	ret = SYS_WARN(wsm_write_mib(hw_priv, WSM_MIB_ID_DOT11_RTS_THRESHOLD,
+		&val32, sizeof(val32), priv->if_id));
+	if (!ret)
+		priv->rts.threshold = threshold;
+	return ret;
+}
+
+void xradio_rts_work(struct work_struct *work)
+{
+	struct xradio_vif *priv =
+		container_of(work, struct xradio_vif, rts_work);
+	sta_printk(XRADIO_DBG_TRC,"%s\n", __func__);
+
+	if (!atomic_read(&priv->enabled))
+		return;
+	sta_printk(XRADIO_DBG_NIY, "if%d dynamic RTS %s\n", priv->if_id,
+		   priv->rts.enabled ? "on" : "off");
+	__xradio_rts_apply(priv);
+}
+
 int xradio_set_rts_threshold(struct ieee80211_hw *hw, u32 value)
 {
 	struct xradio_common *hw_priv = hw->priv;
 	int ret = 0;
-	__le32 val32;
 	struct xradio_vif *priv = NULL;
 	int i =0;
-	int if_id;
 	sta_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
+	if (value != (u32) -1)
+		hw_priv->rts_threshold = value;
+	else
+		hw_priv->rts_threshold = 0; /* disabled */
+
 	xradio_for_each_vif(hw_priv,priv,i) {
 		if (!priv)
 			continue;
-		if_id = priv->if_id;
 #ifdef P2P_MULTIVIF
 		SYS_WARN(priv->if_id == XRWL_GENERIC_IF_ID);
 #endif
-
-		if (value != (u32) -1)
-			val32 = __cpu_to_le32(value);
-		else
-			val32 = 0; /* disabled */
-
 		/* mutex_lock(&priv->conf_mutex); */
-		ret = SYS_WARN(wsm_write_mib(hw_priv, WSM_MIB_ID_DOT11_RTS_THRESHOLD,
-			&val32, sizeof(val32), if_id));
+		ret = __xradio_rts_apply(priv);
 		/* mutex_unlock(&priv->conf_mutex); */
 	}
 	return ret;
@@ -1912,10 +1957,10 @@ void xradio_join_work(struct work_struct *work)
 		hw_priv->ba_ena = false;
 		hw_priv->ba_cnt = 0;
 		hw_priv->ba_acc = 0;
-		hw_priv->ba_hist = 0;
 		hw_priv->ba_cnt_rx = 0;
 		hw_priv->ba_acc_rx = 0;
 		spin_unlock_bh(&hw_priv->ba_lock);
+		xradio_ba_reset(priv, -1);
 
 		mgmt_policy.protectedMgmtEnable = 0;
 		mgmt_policy.unprotectedMgmtFramesAllowed = 1;
@@ -1975,9 +2020,6 @@ void xradio_unjoin_work(struct work_struct *work)
 	struct wsm_reset reset = {
 		.reset_statistics = true,
 	};
-	bool is_htcapie = false;
-	int i;
-	struct xradio_vif *tmp_priv;
 	struct wsm_operational_mode mode = {
 		.power_mode = wsm_power_mode_quiescent,
 		.disableMoreFlagUsage = true,
@@ -2033,6 +2075,7 @@ void xradio_unjoin_work(struct work_struct *work)
 		cancel_delayed_work_sync(&priv->connection_loss_work);
 		SYS_WARN(wsm_set_block_ack_policy(hw_priv,
 			0, hw_priv->ba_tid_mask, priv->if_id));
+		xradio_ba_reset(priv, -1);
 		priv->disable_beacon_filter = false;
 		xradio_update_filtering(priv);
 		priv->setbssparams_done = false;
@@ -2042,26 +2085,6 @@ void xradio_unjoin_work(struct work_struct *work)
 		memset(&priv->firmware_ps_mode, 0,
 			sizeof(priv->firmware_ps_mode));
 		priv->htcap = false;
-		xradio_for_each_vif(hw_priv, tmp_priv, i) {
-#ifdef P2P_MULTIVIF
-			if ((i == (XRWL_MAX_VIFS - 1)) || !tmp_priv)
-#else
-			if (!tmp_priv)
-#endif
-				continue;
-			if ((tmp_priv->join_status == XRADIO_JOIN_STATUS_STA) && tmp_priv->htcap)
-				is_htcapie = true;
-		}
-
-		if (is_htcapie) {
-			hw_priv->vif0_throttle = XRWL_HOST_VIF0_11N_THROTTLE;
-			hw_priv->vif1_throttle = XRWL_HOST_VIF1_11N_THROTTLE;
-			sta_printk(XRADIO_DBG_NIY, "UNJOIN HTCAP 11N %d\n",hw_priv->vif0_throttle);
-		} else {
-			hw_priv->vif0_throttle = XRWL_HOST_VIF0_11BG_THROTTLE;
-			hw_priv->vif1_throttle = XRWL_HOST_VIF1_11BG_THROTTLE;
-			sta_printk(XRADIO_DBG_NIY, "UNJOIN 11BG %d\n",hw_priv->vif0_throttle);
-		}
 		sta_printk(XRADIO_DBG_NIY, "Unjoin.\n");
 	}
 	mutex_unlock(&hw_priv->conf_mutex);
@@ -2165,80 +2188,187 @@ int xradio_set_uapsd_param(struct xradio_vif *priv,
 	return ret;
 }
 
-void xradio_ba_work(struct work_struct *work)
+/* TX aggregation is switched per interface and TID in the firmware, as
+ * the traffic of its links asks for it, see xradio_ba_timer(). */
+bool xradio_ba_managed(struct xradio_vif *priv)
 {
-	struct xradio_common *hw_priv =
-		container_of(work, struct xradio_common, ba_work);
-	u8 tx_ba_tid_mask;
-	sta_printk(XRADIO_DBG_TRC,"%s\n", __func__);
+	switch (priv->join_status) {
+	case XRADIO_JOIN_STATUS_STA:
+		return priv->htcap && priv->setbssparams_done;
+#ifdef AP_AGGREGATE_FW_FIX
+	case XRADIO_JOIN_STATUS_AP:
+		/* The firmware cannot aggregate to several stations. */
+		return priv->hw_priv->connected_sta_cnt <= 1;
+#endif
+	default:
+		return false;
+	}
+}
+
+/* Forget the TX block ack state of a link, or of all links if @link_id
+ * is negative, once the firmware policy was set to TX disabled. */
+void xradio_ba_reset(struct xradio_vif *priv, int link_id)
+{
+	struct xradio_common *hw_priv = priv->hw_priv;
 
-	/* TODO:COMBO: reenable this part of code */
-/*	if (priv->join_status != XRADIO_JOIN_STATUS_STA)
+	spin_lock_bh(&hw_priv->ba_lock);
+	if (link_id < 0) {
+		memset(priv->ba_tid, 0, sizeof(priv->ba_tid));
+		priv->ba_tx_mask = 0;
+		priv->ba_fw_mask = 0;
+	} else if (link_id <= MAX_STA_IN_AP_MODE) {
+		memset(priv->ba_tid[link_id], 0, sizeof(priv->ba_tid[link_id]));
+	}
+	spin_unlock_bh(&hw_priv->ba_lock);
+}
+
+void xradio_ba_tx_status(struct xradio_vif *priv,
+			 const struct xradio_txpriv *txpriv,
+			 bool acked, bool aggregated)
+{
+	struct xradio_common *hw_priv = priv->hw_priv;
+	struct xradio_ba_tid *ba;
+
+	if (txpriv->tid >= XRADIO_MAX_TID ||
+	    txpriv->raw_link_id > MAX_STA_IN_AP_MODE)
 		return;
-	if (!priv->setbssparams_done)
-		return;*/
 
-	sta_printk(XRADIO_DBG_WARN, "BA work****\n");
+	ba = &priv->ba_tid[txpriv->raw_link_id][txpriv->tid];
 	spin_lock_bh(&hw_priv->ba_lock);
-//	tx_ba_tid_mask = hw_priv->ba_ena ? hw_priv->ba_tid_mask : 0;
-	tx_ba_tid_mask = hw_priv->ba_tid_mask;
+	ba->tx_done++;
+	ba->total_done++;
+	if (!acked)
+		ba->tx_fail++;
+	if (aggregated) {
+		ba->tx_agg++;
+		ba->total_agg++;
+	}
 	spin_unlock_bh(&hw_priv->ba_lock);
+}
 
-	wsm_lock_tx(hw_priv);
+void xradio_ba_work(struct work_struct *work)
+{
+	struct xradio_common *hw_priv =
+		container_of(work, struct xradio_common, ba_work);
+	struct xradio_vif *priv;
+	u8 tx_mask, rx_mask;
+	int i;
+	sta_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
-	SYS_WARN(wsm_set_block_ack_policy(hw_priv,
-		tx_ba_tid_mask, hw_priv->ba_tid_mask, -1)); /*TODO:COMBO*/
+	mutex_lock(&hw_priv->conf_mutex);
+	xradio_for_each_vif(hw_priv, priv, i) {
+		if (!priv || !xradio_ba_managed(priv))
+			continue;
+		spin_lock_bh(&hw_priv->ba_lock);
+		tx_mask = priv->ba_tx_mask;
+		spin_unlock_bh(&hw_priv->ba_lock);
+		if (tx_mask == priv->ba_fw_mask)
+			continue;
 
-	wsm_unlock_tx(hw_priv);
+		rx_mask = priv->join_status == XRADIO_JOIN_STATUS_AP ?
+			  XRADIO_RX_BLOCK_ACK_ENABLED_FOR_ALL_TID :
+			  hw_priv->ba_tid_mask;
+		sta_printk(XRADIO_DBG_NIY, "if%d TX block ACK TIDs: 0x%02x\n",
+			   priv->if_id, tx_mask);
+		wsm_lock_tx(hw_priv);
+		if (!SYS_WARN(wsm_set_block_ack_policy(hw_priv,
+				tx_mask, rx_mask, priv->if_id)))
+			priv->ba_fw_mask = tx_mask;
+		wsm_unlock_tx(hw_priv);
+	}
+	mutex_unlock(&hw_priv->conf_mutex);
+}
+
+/* A TID of a link gets TX aggregation once it carries sustained traffic,
+ * and loses it after being idle or when aggregation keeps failing. */
+static u8 xradio_ba_update(struct xradio_vif *priv, bool hold)
+{
+	struct xradio_ba_tid *ba;
+	u8 mask = 0;
+	int link_id, tid;
+
+	for (link_id = 0; link_id <= MAX_STA_IN_AP_MODE; link_id++) {
+		for (tid = 0; tid < XRADIO_MAX_TID; tid++) {
+			ba = &priv->ba_tid[link_id][tid];
+			if (hold)
+				goto next;
+			if (ba->backoff)
+				--ba->backoff;
+
+			if (ba->frames >= XRADIO_BLOCK_ACK_CNT &&
+			    ba->bytes / ba->frames >= XRADIO_BLOCK_ACK_THLD) {
+				ba->idle = 0;
+				if (!ba->backoff)
+					ba->active = true;
+			} else if (ba->active &&
+				   ++ba->idle >= XRADIO_BLOCK_ACK_HIST) {
+				ba->active = false;
+			}
+
+			if (ba->active && ba->tx_done >= XRADIO_BLOCK_ACK_CNT) {
+				if (!ba->tx_agg || ba->tx_fail * 100 >=
+				    ba->tx_done * XRADIO_BLOCK_ACK_FAIL_PCT) {
+					if (++ba->fails >= XRADIO_BLOCK_ACK_HIST) {
+						ba->active = false;
+						ba->fails = 0;
+						ba->backoff = XRADIO_BLOCK_ACK_BACKOFF;
+					}
+				} else {
+					ba->fails = 0;
+				}
+			}
+next:
+			ba->frames = 0;
+			ba->bytes = 0;
+			ba->tx_done = 0;
+			ba->tx_agg = 0;
+			ba->tx_fail = 0;
+			if (ba->active)
+				mask |= BIT(tid);
+		}
+	}
+	return mask & priv->hw_priv->ba_tid_mask;
 }
 
 void xradio_ba_timer(unsigned long arg)
 {
-	bool ba_ena;
 	struct xradio_common *hw_priv = (struct xradio_common *)arg;
+	struct xradio_vif *priv;
+	bool hold, update = false;
+	u8 mask;
+	int i;
 	sta_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
 	spin_lock_bh(&hw_priv->ba_lock);
 	xradio_debug_ba(hw_priv, hw_priv->ba_cnt, hw_priv->ba_acc,
 			hw_priv->ba_cnt_rx, hw_priv->ba_acc_rx);
-
-	if (atomic_read(&hw_priv->scan.in_progress)) {
-		hw_priv->ba_cnt = 0;
-		hw_priv->ba_acc = 0;
-		hw_priv->ba_cnt_rx = 0;
-		hw_priv->ba_acc_rx = 0;
-		goto skip_statistic_update;
-	}
-
-	if (hw_priv->ba_cnt >= XRADIO_BLOCK_ACK_CNT &&
-		(hw_priv->ba_acc / hw_priv->ba_cnt >= XRADIO_BLOCK_ACK_THLD ||
-		(hw_priv->ba_cnt_rx >= XRADIO_BLOCK_ACK_CNT &&
-		hw_priv->ba_acc_rx / hw_priv->ba_cnt_rx >=
-			XRADIO_BLOCK_ACK_THLD)))
-		ba_ena = true;
-	else
-		ba_ena = false;
-
 	hw_priv->ba_cnt = 0;
 	hw_priv->ba_acc = 0;
 	hw_priv->ba_cnt_rx = 0;
 	hw_priv->ba_acc_rx = 0;
 
-	if (ba_ena != hw_priv->ba_ena) {
-		if (ba_ena || ++hw_priv->ba_hist >= XRADIO_BLOCK_ACK_HIST) {
-			hw_priv->ba_ena = ba_ena;
-			hw_priv->ba_hist = 0;
-#if 0
-			sta_printk(XRADIO_DBG_NIY, "%s block ACK:\n",
-				ba_ena ? "enable" : "disable");
-			queue_work(hw_priv->workqueue, &hw_priv->ba_work);
-#endif
+	/* Scan traffic says nothing about the links. */
+	hold = atomic_read(&hw_priv->scan.in_progress);
+	hw_priv->ba_ena = false;
+	xradio_for_each_vif(hw_priv, priv, i) {
+		if (!priv || !xradio_ba_managed(priv))
+			continue;
+		mask = xradio_ba_update(priv, hold);
+		if (mask != priv->ba_tx_mask) {
+			priv->ba_tx_mask = mask;
+			update = true;
 		}
-	} else if (hw_priv->ba_hist)
-		--hw_priv->ba_hist;
-
-skip_statistic_update:
+		if (mask)
+			hw_priv->ba_ena = true;
+	}
+	/* Keep ticking while aggregation is on, to notice idle TIDs. */
+	if (hw_priv->ba_ena)
+		mod_timer(&hw_priv->ba_timer,
+			  jiffies + XRADIO_BLOCK_ACK_INTERVAL);
 	spin_unlock_bh(&hw_priv->ba_lock);
+
+	if (update)
+		queue_work(hw_priv->workqueue, &hw_priv->ba_work);
 }
 
 int xradio_vif_setup(struct xradio_vif *priv)
@@ -2261,6 +2391,7 @@ int xradio_vif_setup(struct xradio_vif *priv)
 	priv->bss_loss_status = XRADIO_BSS_LOSS_NONE;
 	spin_lock_init(&priv->bss_loss_lock);
 	INIT_WORK(&priv->tx_failure_work, xradio_tx_failure_work);
+	INIT_WORK(&priv->rts_work, xradio_rts_work);
 	spin_lock_init(&priv->ps_state_lock);
 	INIT_DELAYED_WORK(&priv->set_cts_work, xradio_set_cts_work);
 	INIT_WORK(&priv->set_tim_work, xradio_set_tim_work);
@@ -47,6 +47,7 @@ void xradio_configure_filter(struct ieee80211_hw *dev,
                              unsigned int changed_flags,
                              unsigned int *total_flags,
                              u64 multicast);
+int xradio_set_tx_lifetime(struct xradio_vif *priv, int queue);
 int xradio_conf_tx(struct ieee80211_hw *dev, struct ieee80211_vif *vif,
                    u16 queue, const struct ieee80211_tx_queue_params *params);
 int xradio_get_stats(struct ieee80211_hw *dev,
@@ -93,6 +94,7 @@ void xradio_bss_loss_work(struct work_struct *work);
 void xradio_connection_loss_work(struct work_struct *work);
 void xradio_keep_alive_work(struct work_struct *work);
 void xradio_tx_failure_work(struct work_struct *work);
+void xradio_rts_work(struct work_struct *work);
 
 /* ******************************************************************** */
 /* Internal API								*/
@@ -112,6 +114,11 @@ int xradio_disable_listening(struct xradio_vif *priv);
 int xradio_set_uapsd_param(struct xradio_vif *priv, const struct wsm_edca_params *arg);
 void xradio_ba_work(struct work_struct *work);
 void xradio_ba_timer(unsigned long arg);
+bool xradio_ba_managed(struct xradio_vif *priv);
+void xradio_ba_reset(struct xradio_vif *priv, int link_id);
+void xradio_ba_tx_status(struct xradio_vif *priv,
+			 const struct xradio_txpriv *txpriv,
+			 bool acked, bool aggregated);
 const u8 *xradio_get_ie(u8 *start, size_t len, u8 ie);
 int xradio_vif_setup(struct xradio_vif *priv);
 int xradio_setup_mac_pvif(struct xradio_vif *priv);
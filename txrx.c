@@ -12,6 +12,11 @@
 #include <net/mac80211.h>
 #include <linux/etherdevice.h>
 #include <linux/skbuff.h>
+#include <linux/jhash.h>
+#include <linux/hash.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <net/ipv6.h>
 
 #include "xradio.h"
 #include "wsm.h"
@@ -24,11 +29,6 @@
 #define AG_RATE_INDEX  6     //11a/g rate for important short frames in 5G.
 #define XRADIO_INVALID_RATE_ID (0xFF)
 
-/* rate should fall quickly to avoid dropping frames by aps.
- * Add by yangfh 2014-9-22 13:39:57
- */
-#define HIGH_RATE_MAX_RETRY  7
-
 #ifdef CONFIG_XRADIO_TESTMODE
 #include "nl80211_testmode_msg_copy.h"
 #endif /* CONFIG_XRADIO_TESTMODE */
@@ -239,211 +239,81 @@ static void xradio_remove_ht_ie(struct xradio_vif *priv, struct sk_buff *skb)
 }
 #endif //AP_HT_COMPAT_FIX
 
-//modified by yangfh
+/* The policy is a retry count per hw rate, the firmware tries the rates
+ * from the highest down. Keep the rates mac80211 asked for as they are,
+ * only merging duplicates and fitting the tries into the retry limit. */
 static void tx_policy_build(const struct xradio_common *hw_priv,
 	/* [out] */ struct tx_policy *policy,
-	struct ieee80211_tx_rate *rates, size_t count)
+	const struct ieee80211_tx_rate *req, size_t count)
 {
-	int i, j;
-	struct ieee80211_rate * tmp_rate = NULL;
+	struct ieee80211_tx_rate rates[IEEE80211_TX_MAX_RATES] = {{0}};
+	const struct ieee80211_rate *tmp_rate;
 	unsigned limit = hw_priv->short_frame_max_tx_count;
-	unsigned max_rates_cnt = count;
 	unsigned total = 0;
-	SYS_BUG(rates[0].idx < 0);
+	int i, j, n = 0;
+	SYS_BUG(req[0].idx < 0);
 	memset(policy, 0, sizeof(*policy));
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
-	txrx_printk(XRADIO_DBG_NIY,"============================");
-#if 0
-	//debug yangfh
-	for (i = 0; i < count; ++i) {
-		if(rates[i].idx>=0) {
-			tmp_rate = xradio_get_tx_rate(hw_priv, &rates[i]);
-			txrx_printk(XRADIO_DBG_NIY,"[TX policy] Org %d.%dMps=%d", 
-		            tmp_rate->bitrate/10, tmp_rate->bitrate%10, rates[i].count);
-		}
-	}
-	txrx_printk(XRADIO_DBG_NIY,"----------------------------");
-#endif
-	
-	/* minstrel is buggy a little bit, so distille
-	 * incoming rates first.
-	 */
-	/* Sort rates in descending order. */
-	total = rates[0].count;
-	for (i = 1; i < count; ++i) {
-		if (rates[i].idx > rates[i-1].idx) {
-			rates[i].idx = rates[i-1].idx>0?(rates[i-1].idx-1):-1;
-		}
-		if (rates[i].idx < 0 || i>=limit) {
-			count = i;
-			break;
-		} else {
-			total += rates[i].count;
-		}
-	}
+	/* Eliminate duplicates. Entries differing only in SGI/RTS flags
+	 * still share one hw rate nibble, so merge by hw rate. */
+	for (i = 0; i < count && req[i].idx >= 0; ++i) {
+		const struct ieee80211_rate *dup;
 
-	/* Add lowest rate to the end when 11a/n. 
-	 * Don't apply in 11b/g because p2p unsupport 1Mbps.
-	 * TODO: it's better to do this in rate control of mac80211.
-	 */
-	if (((rates[0].flags & IEEE80211_TX_RC_MCS) || 
-		   hw_priv->channel->band == NL80211_BAND_5GHZ) && 
-		  count < max_rates_cnt && rates[count-1].idx != 0) {
-		rates[count].idx   = 0;
-		rates[count].count = rates[0].count;
-		rates[count].flags = rates[0].flags;
-		total += rates[count].count;
-		count++;
-	}
-
-	/* adjust tx count to limit, rates should fall quickly 
-	 * and lower rates should be more retry, because reorder 
-	 * buffer of reciever will be timeout and clear probably.
-	 */
-	if (count < 2) {
-		rates[0].count = limit;
-		total = limit;
-	} else {
-		u8 end_retry = 0;  //the retry should be add to last rate.
-		if (limit > HIGH_RATE_MAX_RETRY) {
-			end_retry = limit - HIGH_RATE_MAX_RETRY;
-			limit     = HIGH_RATE_MAX_RETRY;
-		}
-		for (i = 0; (limit != total) && (i < 100); ++i) {  //i<100 to avoid dead loop
-			j = i % count;
-			if(limit < total) {
-				total += (rates[j].count > 1? -1 : 0);
-				rates[j].count += (rates[j].count > 1? -1 : 0);
-			} else {
-				j = count - 1 - j;
-				if (rates[j].count > 0) {
-					total++;
-					rates[j].count++;
-				}
-			}
-		}
-		if (end_retry) {
-			rates[count-1].count += end_retry;
-			limit += end_retry;
-		}
-	}
-	
-	/* Eliminate duplicates. */
-	total = rates[0].count;
-	for (i = 0, j = 1; j < count; ++j) {
-		if (rates[j].idx == rates[i].idx) {
-			rates[i].count += rates[j].count;
-		} else if (rates[j].idx > rates[i].idx) {
-			break;
-		} else {
-			++i;
-			if (i != j)
-				rates[i] = rates[j];
+		tmp_rate = xradio_get_tx_rate(hw_priv, &req[i]);
+		for (j = 0; j < n; ++j) {
+			dup = xradio_get_tx_rate(hw_priv, &rates[j]);
+			if (tmp_rate && dup &&
+			    dup->hw_value == tmp_rate->hw_value)
+				break;
 		}
-		total += rates[j].count;
+		if (j == n)
+			rates[n++] = req[i];
+		else
+			rates[j].count += req[i].count;
+		total += req[i].count;
 	}
-	count = i + 1;
 
-	/* Re-fill policy trying to keep every requested rate and with
-	 * respect to the global max tx retransmission count. 
-	 */
-	if (limit < count)
-		limit = count;
+	/* Keep every requested rate within the max tx retransmissions. */
+	if (limit < n)
+		limit = n;
 	if (total > limit) {
-		for (i = 0; i < count; ++i) {
-			int left = count - i - 1;
+		for (i = 0; i < n; ++i) {
+			int left = n - i - 1;
 			if (rates[i].count > limit - left)
 				rates[i].count = limit - left;
 			limit -= rates[i].count;
 		}
 	}
 
-	/* HACK!!! Device has problems (at least) switching from
-	 * 54Mbps CTS to 1Mbps. This switch takes enormous amount
-	 * of time (100-200 ms), leading to valuable throughput drop.
-	 * As a workaround, additional g-rates are injected to the
-	 * policy.
-	 */
-	if (count == 2 && !(rates[0].flags & IEEE80211_TX_RC_MCS) &&
-			rates[0].idx > 4 && rates[0].count > 2 &&
-			rates[1].idx < 2) {
-		/* ">> 1" is an equivalent of "/ 2", but faster */
-		int mid_rate = (rates[0].idx + 4) >> 1;
-
-		/* Decrease number of retries for the initial rate */
-		rates[0].count -= 2;
-
-		if (mid_rate != 4) {
-			/* Keep fallback rate at 1Mbps. */
-			rates[3] = rates[1];
-
-			/* Inject 1 transmission on lowest g-rate */
-			rates[2].idx = 4;
-			rates[2].count = 1;
-			rates[2].flags = rates[1].flags;
-
-			/* Inject 1 transmission on mid-rate */
-			rates[1].idx = mid_rate;
-			rates[1].count = 1;
-
-			/* Fallback to 1 Mbps is a really bad thing,
-			 * so let's try to increase probability of
-			 * successful transmission on the lowest g rate
-			 * even more */
-			if (rates[0].count >= 3) {
-				--rates[0].count;
-				++rates[2].count;
-			}
-
-			/* Adjust amount of rates defined */
-			count += 2;
-		} else {
-			/* Keep fallback rate at 1Mbps. */
-			rates[2] = rates[1];
-
-			/* Inject 2 transmissions on lowest g-rate */
-			rates[1].idx = 4;
-			rates[1].count = 2;
-
-			/* Adjust amount of rates defined */
-			count += 1;
-		}
-	}
-	
-	tmp_rate = (struct ieee80211_rate *)xradio_get_tx_rate(hw_priv, &rates[0]);
-	if(tmp_rate)
-		policy->defined = tmp_rate->hw_value + 1;
-
-	for (i = 0; i < count; ++i) {
+	for (i = 0; i < n; ++i) {
 		register unsigned rateid, off, shift, retries;
-		
-		tmp_rate = (struct ieee80211_rate *)xradio_get_tx_rate(hw_priv, &rates[i]);
-		if(tmp_rate) {
-			rateid = tmp_rate->hw_value;
-		} else {
-			break;
-		}
+
+		tmp_rate = xradio_get_tx_rate(hw_priv, &rates[i]);
+		if (!tmp_rate)
+			continue;
+		rateid = tmp_rate->hw_value;
 		off = rateid >> 3;		/* eq. rateid / 8 */
 		shift = (rateid & 0x07) << 2;	/* eq. (rateid % 8) * 4 */
 
-		retries = rates[i].count;
-		if (unlikely(retries > 0x0F))
-			rates[i].count = retries = 0x0F;
+		retries = min_t(unsigned, rates[i].count, 0x0F);
+		if (!retries)
+			continue;
 		policy->tbl[off] |= __cpu_to_le32(retries << shift);
 		policy->retry_count += retries;
-		txrx_printk(XRADIO_DBG_NIY,"[TX policy] %d.%dMps=%d", 
+		if (policy->defined <= rateid)
+			policy->defined = rateid + 1;
+		txrx_printk(XRADIO_DBG_NIY,"[TX policy] %d.%dMps=%d",
 		            tmp_rate->bitrate/10, tmp_rate->bitrate%10, retries);
 	}
-	
+
 	txrx_printk(XRADIO_DBG_MSG, "[TX policy] Dst Policy (%d): " \
-		"%d:%d, %d:%d, %d:%d, %d:%d, %d:%d\n",
-		count,
+		"%d:%d, %d:%d, %d:%d, %d:%d\n",
+		n,
 		rates[0].idx, rates[0].count,
 		rates[1].idx, rates[1].count,
 		rates[2].idx, rates[2].count,
-		rates[3].idx, rates[3].count,
-		rates[4].idx, rates[4].count);
+		rates[3].idx, rates[3].count);
 }
 
 static inline bool tx_policy_is_equal(const struct tx_policy *wanted,
@@ -464,19 +334,29 @@ static inline bool tx_policy_is_equal(const struct tx_policy *wanted,
 	return true;
 }
 
+static inline u32 tx_policy_hash(const struct tx_policy *policy)
+{
+	return hash_32(jhash2((const u32 *)policy->tbl, ARRAY_SIZE(policy->tbl),
+			      policy->defined), TX_POLICY_HASH_BITS);
+}
+
 static int tx_policy_find(struct tx_policy_cache *cache,
 				const struct tx_policy *wanted)
 {
-	/* O(n) complexity. Not so good, but there's only 8 entries in
-	 * the cache.
-	 * Also lru helps to reduce search time. */
 	struct tx_policy_cache_entry *it;
-	/* Search for policy in "used" list */
+
+	/* Exact match through the hash first. */
+	hlist_for_each_entry(it, &cache->hash[tx_policy_hash(wanted)], hnode) {
+		if (it->policy.defined == wanted->defined &&
+		    !memcmp(it->policy.tbl, wanted->tbl, sizeof(wanted->tbl)))
+			return it - cache->cache;
+	}
+	/* Then a cached policy covering the wanted one, used entries
+	 * before idle ones. */
 	list_for_each_entry(it, &cache->used, link) {
 		if (tx_policy_is_equal(wanted, &it->policy))
 			return it - cache->cache;
 	}
-	/* Then - in "free list" */
 	list_for_each_entry(it, &cache->free, link) {
 		if (tx_policy_is_equal(wanted, &it->policy))
 			return it - cache->cache;
@@ -484,6 +364,35 @@ static int tx_policy_find(struct tx_policy_cache *cache,
 	return -1;
 }
 
+/* Whether @it reaches closer above the wanted top rate than @best, or
+ * closer below it if neither reaches it. */
+static inline bool tx_policy_closer(const struct tx_policy *it,
+				    const struct tx_policy *best,
+				    const struct tx_policy *wanted)
+{
+	return !best ||
+	       (it->defined >= wanted->defined &&
+		(best->defined < wanted->defined ||
+		 it->defined < best->defined)) ||
+	       (it->defined < wanted->defined &&
+		best->defined < it->defined);
+}
+
+/* All entries are in use: take the one reaching closest above the
+ * wanted top rate, the retries below it are still a sane fallback. */
+static int tx_policy_nearest(struct tx_policy_cache *cache,
+			     const struct tx_policy *wanted)
+{
+	struct tx_policy_cache_entry *it, *best = NULL;
+
+	list_for_each_entry(it, &cache->used, link) {
+		if (tx_policy_closer(&it->policy,
+				     best ? &best->policy : NULL, wanted))
+			best = it;
+	}
+	return best ? best - cache->cache : -1;
+}
+
 static inline void tx_policy_use(struct tx_policy_cache *cache,
 				 struct tx_policy_cache_entry *entry)
 {
@@ -503,6 +412,13 @@ static inline int tx_policy_release(struct tx_policy_cache *cache,
 /* ******************************************************************** */
 /* External TX policy cache API						*/
 
+/* TX descriptors refer to policy entries by index and version, drop
+ * them whenever the cache or the retry limits change. */
+void xradio_tx_desc_flush(struct xradio_common *hw_priv)
+{
+	atomic_inc(&hw_priv->tx_desc_gen);
+}
+
 void tx_policy_init(struct xradio_common *hw_priv)
 {
 	struct tx_policy_cache *cache = &hw_priv->tx_policy_cache;
@@ -515,12 +431,23 @@ void tx_policy_init(struct xradio_common *hw_priv)
 	INIT_LIST_HEAD(&cache->used);
 	INIT_LIST_HEAD(&cache->free);
 
-	for (i = 0; i < TX_POLICY_CACHE_SIZE; ++i)
+	for (i = 0; i < TX_POLICY_CACHE_SIZE; ++i) {
 		list_add(&cache->cache[i].link, &cache->free);
+		INIT_HLIST_NODE(&cache->cache[i].hnode);
+	}
+	xradio_tx_desc_flush(hw_priv);
+}
+
+/* Frames using a policy wait in the queue until it reached the device,
+ * see __xradio_queue_link_first(). */
+bool tx_policy_ready(struct xradio_common *hw_priv, int idx)
+{
+	return idx >= TX_POLICY_CACHE_SIZE ||
+		!(READ_ONCE(hw_priv->tx_policy_cache.pending_map) & BIT(idx));
 }
 
 static int tx_policy_get(struct xradio_common *hw_priv,
-		  struct ieee80211_tx_rate *rates,
+		  const struct ieee80211_tx_rate *rates,
 		  u8 use_bg_rate, bool *renew)
 {
 	int idx;
@@ -551,36 +478,41 @@ static int tx_policy_get(struct xradio_common *hw_priv,
 #endif
 
 	spin_lock_bh(&cache->lock);
+	*renew = false;
 	idx = tx_policy_find(cache, &wanted);
 	if (idx >= 0) {
 		txrx_printk(XRADIO_DBG_MSG, "[TX policy] Used TX policy: %d\n",
 					idx);
-		*renew = false;
-	} else {
-		struct tx_policy_cache_entry *entry;
-		if (WARN_ON_ONCE(list_empty(&cache->free))) {
+	} else if (list_empty(&cache->free)) {
+		/* No idle entry to replace, make do with a close one. */
+		idx = tx_policy_nearest(cache, &wanted);
+		if (WARN_ON_ONCE(idx < 0)) {
 			spin_unlock_bh(&cache->lock);
 			txrx_printk(XRADIO_DBG_ERROR, "[TX policy] no policy cache\n");
 			return XRADIO_INVALID_RATE_ID;
 		}
+		txrx_printk(XRADIO_DBG_MSG, "[TX policy] Nearest TX policy: %d\n",
+					idx);
+	} else {
+		struct tx_policy_cache_entry *entry;
 		/* If policy is not found create a new one
-		 * using the oldest entry in "free" list */
+		 * using the least recently used idle entry. */
 		*renew = true;
 		entry = list_entry(cache->free.prev,
 			struct tx_policy_cache_entry, link);
+		hlist_del_init(&entry->hnode);
+		wanted.version = entry->policy.version + 1;
 		entry->policy = wanted;
+		hlist_add_head(&entry->hnode,
+			       &cache->hash[tx_policy_hash(&entry->policy)]);
 		idx = entry - cache->cache;
+		cache->pending_map |= BIT(idx);
+		cache->failed_map &= ~BIT(idx);
 		txrx_printk(XRADIO_DBG_MSG, "[TX policy] New TX policy: %d\n",
 					idx);
 		tx_policy_dump(&entry->policy);
 	}
 	tx_policy_use(cache, &cache->cache[idx]);
-	if (unlikely(list_empty(&cache->free))) {
-		/* Lock TX queues. */
-		txrx_printk(XRADIO_DBG_WARN, "[TX policy] policy cache used up\n");
-		xradio_tx_queues_lock(hw_priv);
-	}
-	spin_unlock_bh(&cache->lock);
 
 	/*force to upload retry limit when using debug rate policy */
 #ifdef CONFIG_XRADIO_DEBUGFS
@@ -589,25 +521,76 @@ static int tx_policy_get(struct xradio_common *hw_priv,
 		//retry dgb need to be applied to policy.
 		*renew = true;
 		cache->cache[idx].policy.uploaded = 0;
+		cache->pending_map |= BIT(idx);
 	}
 #endif
+	spin_unlock_bh(&cache->lock);
 
 	return idx;
 }
 
+/* A frame waiting for an entry the device kept refusing, see
+ * tx_policy_upload(), moves to the uploaded entry closest to it, which
+ * is what the device really has. False if there is none, the frame then
+ * waits for the entry to be uploaded with the next change. Called with
+ * the queue lock held. */
+bool tx_policy_fallback(struct xradio_common *hw_priv, struct sk_buff *skb,
+			struct xradio_txpriv *txpriv)
+{
+	struct tx_policy_cache *cache = &hw_priv->tx_policy_cache;
+	struct tx_policy_cache_entry *entry, *best = NULL;
+	struct wsm_tx *wsm = (struct wsm_tx *)skb->data;
+	int i;
+
+	spin_lock_bh(&cache->lock);
+	if (!(cache->failed_map & BIT(txpriv->rate_id))) {
+		spin_unlock_bh(&cache->lock);
+		return false;
+	}
+	entry = &cache->cache[txpriv->rate_id];
+	for (i = 0; i < TX_POLICY_CACHE_SIZE; ++i) {
+		struct tx_policy *it = &cache->cache[i].policy;
+
+		if (!it->retry_count || !it->uploaded ||
+		    (cache->pending_map & BIT(i)))
+			continue;
+		if (tx_policy_closer(it, best ? &best->policy : NULL,
+				     &entry->policy))
+			best = &cache->cache[i];
+	}
+	if (best) {
+		tx_policy_use(cache, best);
+		tx_policy_release(cache, entry);
+		txpriv->rate_id = best - cache->cache;
+		wsm->flags = (wsm->flags & ~0x70) | (txpriv->rate_id << 4);
+	}
+	spin_unlock_bh(&cache->lock);
+	return best != NULL;
+}
+
+/* Reuse the policy of a TX descriptor unless the entry was recycled. */
+static bool tx_policy_get_cached(struct xradio_common *hw_priv,
+				 int idx, u8 version)
+{
+	struct tx_policy_cache *cache = &hw_priv->tx_policy_cache;
+	struct tx_policy_cache_entry *entry = &cache->cache[idx];
+	bool ret;
+
+	spin_lock_bh(&cache->lock);
+	ret = entry->policy.version == version;
+	if (ret)
+		tx_policy_use(cache, entry);
+	spin_unlock_bh(&cache->lock);
+	return ret;
+}
+
 static void tx_policy_put(struct xradio_common *hw_priv, int idx)
 {
-	int usage, locked;
 	struct tx_policy_cache *cache = &hw_priv->tx_policy_cache;
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
 	spin_lock_bh(&cache->lock);
-	locked = list_empty(&cache->free);
-	usage = tx_policy_release(cache, &cache->cache[idx]);
-	if (unlikely(locked) && !usage) {
-		/* Unlock TX queues. */
-		xradio_tx_queues_unlock(hw_priv);
-	}
+	tx_policy_release(cache, &cache->cache[idx]);
 	spin_unlock_bh(&cache->lock);
 }
 
@@ -627,12 +610,13 @@ extern u32 policy_num;
 static int tx_policy_upload(struct xradio_common *hw_priv)
 {
 	struct tx_policy_cache *cache = &hw_priv->tx_policy_cache;
-	int i;
+	int i, ret;
 	struct wsm_set_tx_rate_retry_policy arg = {
 		.hdr = {
 			.numTxRatePolicies = 0,
 		}
 	};
+	u8 version[TX_POLICY_CACHE_SIZE];
 	int if_id = 0;
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
@@ -656,7 +640,7 @@ static int tx_policy_upload(struct xradio_common *hw_priv)
 			dst->policyFlags = BIT(2) | BIT(3);
 			memcpy(dst->rateCountIndices, src->tbl,
 					sizeof(dst->rateCountIndices));
-			src->uploaded = 1;
+			version[i] = src->version;
 			++arg.hdr.numTxRatePolicies;
 		}
 	}
@@ -676,10 +660,47 @@ static int tx_policy_upload(struct xradio_common *hw_priv)
 	policy_upload++;
 	policy_num += arg.hdr.numTxRatePolicies;
 #endif
+	if (!arg.hdr.numTxRatePolicies)
+		return 0;
 	/*TODO: COMBO*/
-	return wsm_set_tx_rate_retry_policy(hw_priv, &arg, if_id);
+	ret = wsm_set_tx_rate_retry_policy(hw_priv, &arg, if_id);
+
+	/* Release the frames waiting for these entries, unless an entry
+	 * was reused meanwhile and needs another upload. A failed upload
+	 * is retried. After the last retry the entries stay pending, to be
+	 * uploaded again with the next change, and their frames move to
+	 * entries the device has, see tx_policy_fallback(). */
+	spin_lock_bh(&cache->lock);
+	if (ret && ++cache->upload_retry < TX_POLICY_UPLOAD_RETRY) {
+		spin_unlock_bh(&cache->lock);
+		if (atomic_add_return(1, &hw_priv->upload_count) == 1) {
+			if (queue_work(hw_priv->workqueue,
+				  &hw_priv->tx_policy_upload_work) <= 0)
+				atomic_set(&hw_priv->upload_count, 0);
+		}
+		return ret;
+	}
+	cache->upload_retry = 0;
+	for (i = 0; i < arg.hdr.numTxRatePolicies; ++i) {
+		int idx = arg.tbl[i].policyIndex;
+		struct tx_policy *src = &cache->cache[idx].policy;
+		if (src->version != version[idx])
+			continue;
+		src->uploaded = !ret;
+		if (ret) {
+			cache->failed_map |= BIT(idx);
+		} else {
+			cache->pending_map &= ~BIT(idx);
+			cache->failed_map &= ~BIT(idx);
+		}
+	}
+	spin_unlock_bh(&cache->lock);
+	xradio_bh_wakeup(hw_priv);
+	return ret;
 }
 
+/* Runs without wsm_lock_tx(): only the frames of the entries being
+ * uploaded are held back, everything else keeps flowing. */
 void tx_policy_upload_work(struct work_struct *work)
 {
 	struct xradio_common *hw_priv =
@@ -687,7 +708,6 @@ void tx_policy_upload_work(struct work_struct *work)
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
 	SYS_WARN(tx_policy_upload(hw_priv));
-	wsm_unlock_tx(hw_priv);
 }
 
 /* ******************************************************************** */
@@ -702,6 +722,9 @@ struct xradio_txinfo {
 	size_t hdrlen;
 	const u8 *da;
 	struct xradio_sta_priv *sta_priv;
+	struct xradio_tx_desc *desc;
+	bool desc_hit;
+	u32 desc_gen;
 	struct xradio_txpriv txpriv;
 };
 
@@ -733,6 +756,22 @@ xradio_get_tx_rate(const struct xradio_common *hw_priv,
 		bitrates[rate->idx];
 }
 
+/* The firmware starts at the highest rate of the policy. */
+static const struct ieee80211_rate *
+xradio_get_top_rate(const struct xradio_common *hw_priv,
+		    const struct ieee80211_tx_rate *rates)
+{
+	const struct ieee80211_rate *top = NULL, *rate;
+	int i;
+
+	for (i = 0; i < IEEE80211_TX_MAX_RATES && rates[i].idx >= 0; ++i) {
+		rate = xradio_get_tx_rate(hw_priv, &rates[i]);
+		if (!top || rate->hw_value > top->hw_value)
+			top = rate;
+	}
+	return top;
+}
+
 inline static s8
 xradio_get_rate_idx(const struct xradio_common *hw_priv, u8 flag, u16 hw_value)
 {
@@ -775,6 +814,15 @@ xradio_tx_h_calc_link_ids(struct xradio_vif *priv,
 		t->txpriv.offchannel_if_id = 0;
 #endif
 
+	if (t->desc_hit) {
+		t->txpriv.raw_link_id = t->desc->raw_link_id;
+		t->txpriv.link_id = t->desc->link_id;
+		if (t->txpriv.raw_link_id)
+			priv->link_id_db[t->txpriv.raw_link_id - 1].timestamp =
+					jiffies;
+		return 0;
+	}
+
 	if (likely(control->sta && t->sta_priv->link_id))
 		t->txpriv.raw_link_id =
 				t->txpriv.link_id =
@@ -819,6 +867,10 @@ xradio_tx_h_calc_link_ids(struct xradio_vif *priv,
 			(control->sta->uapsd_queues & BIT(t->queue)))
 		t->txpriv.link_id = priv->link_id_uapsd;
 #endif /* CONFIG_XRADIO_USE_EXTENSIONS */
+	if (t->desc) {
+		t->desc->raw_link_id = t->txpriv.raw_link_id;
+		t->desc->link_id = t->txpriv.link_id;
+	}
 	return 0;
 }
 
@@ -849,16 +901,41 @@ xradio_tx_h_calc_tid(struct xradio_vif *priv,
 	}
 }
 
-/* IV/ICV injection. */
-/* TODO: Quite unoptimal. It's better co modify mac80211
- * to reserve space for IV */
+/* Data frames on the BH path reuse the link, crypto and rate policy setup
+ * of the previous frame on the same station and TID. Only the BH fills
+ * and reads the descriptors, so they need no locking. */
+static void
+xradio_tx_h_desc(struct xradio_common *hw_priv,
+		 struct ieee80211_tx_control *control,
+		 struct xradio_txinfo *t)
+{
+	struct xradio_tx_desc *desc;
+
+	if (!control->sta || t->txpriv.tid >= XRADIO_MAX_TID ||
+	    t->txpriv.use_bg_rate)
+		return;
+#ifdef CONFIG_XRADIO_DEBUGFS
+	if (rates_dbg_en || retry_dbg)
+		return;
+#endif
+
+	desc = &t->sta_priv->tx_desc[t->txpriv.tid];
+	t->desc = desc;
+	t->desc_gen = atomic_read(&hw_priv->tx_desc_gen);
+	t->desc_hit = desc->gen == t->desc_gen && desc->queue == t->queue;
+	if (!t->desc_hit)
+		desc->gen = 0;
+}
+
+/* IV/ICV injection. mac80211 already left room for the IV and reserves
+ * tailroom for the ICV/MIC, see xradio_set_key(), except on fast-xmit,
+ * where the frame only has the tailroom it happens to have. */
 static int
 xradio_tx_h_crypt(struct xradio_vif *priv,
 		  struct xradio_txinfo *t)
 {
 	size_t iv_len;
 	size_t icv_len;
-	u8 *icv;
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
 	if (!t->tx_info->control.hw_key ||
@@ -866,45 +943,47 @@ xradio_tx_h_crypt(struct xradio_vif *priv,
 	     __cpu_to_le32(IEEE80211_FCTL_PROTECTED)))
 		return 0;
 
-	iv_len = t->tx_info->control.hw_key->iv_len;
-	icv_len = t->tx_info->control.hw_key->icv_len;
-
-	if (t->tx_info->control.hw_key->cipher == WLAN_CIPHER_SUITE_TKIP)
-		icv_len += 8; /* MIC */
+	if (t->desc_hit && t->desc->key == t->tx_info->control.hw_key) {
+		iv_len = t->desc->iv_len;
+		icv_len = t->desc->icv_len;
+	} else {
+		iv_len = t->tx_info->control.hw_key->iv_len;
+		icv_len = t->tx_info->control.hw_key->icv_len;
+
+		if (t->tx_info->control.hw_key->cipher == WLAN_CIPHER_SUITE_TKIP)
+			icv_len += 8; /* MIC */
+		if (t->desc) {
+			t->desc->key = t->tx_info->control.hw_key;
+			t->desc->iv_len = iv_len;
+			t->desc->icv_len = icv_len;
+		}
+	}
 
-	if ((skb_headroom(t->skb) + skb_tailroom(t->skb) <
-			 iv_len + icv_len + WSM_TX_EXTRA_HEADROOM) ||
-			(skb_headroom(t->skb) <
-			 iv_len + WSM_TX_EXTRA_HEADROOM)) {
+	if (skb_headroom(t->skb) < WSM_TX_EXTRA_HEADROOM) {
 		txrx_printk(XRADIO_DBG_ERROR,
 			"Bug: no space allocated for crypto headers.\n"
 			"headroom: %d, tailroom: %d, "
 			"req_headroom: %d, req_tailroom: %d\n"
 			"Please fix it in xradio_get_skb().\n",
 			skb_headroom(t->skb), skb_tailroom(t->skb),
-			iv_len + WSM_TX_EXTRA_HEADROOM, icv_len);
+			WSM_TX_EXTRA_HEADROOM, icv_len);
 		return -ENOMEM;
-	} else if (skb_tailroom(t->skb) < icv_len) {
-		size_t offset = icv_len - skb_tailroom(t->skb);
-		u8 *p;
-		txrx_printk(XRADIO_DBG_ERROR,
+	} else if (unlikely(skb_tailroom(t->skb) < icv_len)) {
+		txrx_printk(XRADIO_DBG_NIY,
 			"Slowpath: tailroom is not big enough. "
 			"Req: %d, got: %d.\n",
 			icv_len, skb_tailroom(t->skb));
 
-		p = skb_push(t->skb, offset);
-		memmove(p, &p[offset], t->skb->len - offset);
-		skb_trim(t->skb, t->skb->len - offset);
-	}
-	/* ccmp pkt from umac to driver,it has iv room,,so ccmp pkt do not add iv room */
-	if (t->tx_info->control.hw_key->cipher != WLAN_CIPHER_SUITE_CCMP){
-		u8 *newhdr;
-		newhdr = skb_push(t->skb, iv_len);
-		memmove(newhdr, newhdr + iv_len, t->hdrlen);
-		t->hdr = (struct ieee80211_hdr *) newhdr;
+		if (pskb_expand_head(t->skb, 0,
+				     icv_len - skb_tailroom(t->skb),
+				     GFP_ATOMIC))
+			return -ENOMEM;
+		t->hdr = (struct ieee80211_hdr *)t->skb->data;
+		t->da = ieee80211_get_DA(t->hdr);
+		xradio_debug_tx_tail_copy(priv);
 	}
 	t->hdrlen += iv_len;
-	icv = skb_put(t->skb, icv_len);
+	skb_put(t->skb, icv_len);
 
 	return 0;
 }
@@ -929,12 +1008,14 @@ xradio_tx_h_align(struct xradio_vif *priv, struct xradio_txinfo *t,
 		return -ENOMEM;
 	}
     //offset = 1or3 process   add by dingxh
-	if (offset & 1) {
+	/* The firmware can only skip two bytes. extra_tx_headroom keeps
+	 * mac80211 frames aligned, so this is for odd skbs only. */
+	if (unlikely(offset & 1)) {
 		newhdr = skb_push(t->skb, offset);
 		memmove(newhdr, newhdr + offset, t->skb->len-offset);
 		skb_trim(t->skb, t->skb->len-offset);
 		t->hdr = (struct ieee80211_hdr *) newhdr;
-		xradio_debug_tx_align(priv);
+		xradio_debug_tx_align_copy(priv);
 		return 0;
 	}
   //add by dingxh
@@ -1064,6 +1145,18 @@ xradio_tx_h_rate_policy(struct xradio_common *hw_priv, struct xradio_txinfo *t,
 	}
 #endif
 
+	if (t->desc_hit &&
+	    !memcmp(t->desc->rates, t->tx_info->control.rates,
+		    sizeof(t->desc->rates)) &&
+	    tx_policy_get_cached(hw_priv, t->desc->rate_id,
+				 t->desc->rate_version)) {
+		t->txpriv.rate_id = t->desc->rate_id;
+		t->rate = t->desc->rate;
+		wsm->flags |= t->txpriv.rate_id << 4;
+		wsm->maxTxRate = t->desc->max_tx_rate;
+		wsm->htTxParameters |= t->desc->ht_tx_params;
+		return 0;
+	}
 	t->txpriv.rate_id = tx_policy_get(hw_priv,
 		t->tx_info->control.rates, t->txpriv.use_bg_rate,
 		&tx_policy_renew);
@@ -1071,7 +1164,7 @@ xradio_tx_h_rate_policy(struct xradio_common *hw_priv, struct xradio_txinfo *t,
 		return -EFAULT;
 
 	wsm->flags |= t->txpriv.rate_id << 4;
-	t->rate = xradio_get_tx_rate(hw_priv, &t->tx_info->control.rates[0]);
+	t->rate = xradio_get_top_rate(hw_priv, t->tx_info->control.rates);
 	if (t->txpriv.use_bg_rate)
 		wsm->maxTxRate = (u8)(t->txpriv.use_bg_rate & 0x3f);
 	else
@@ -1094,32 +1187,37 @@ xradio_tx_h_rate_policy(struct xradio_common *hw_priv, struct xradio_txinfo *t,
 				__cpu_to_le32(WSM_HT_TX_MIXED);
 	}
 
+	if (t->desc) {
+		/* Our reference keeps the entry from being recycled. */
+		t->desc->rate_id = t->txpriv.rate_id;
+		t->desc->rate_version =
+			hw_priv->tx_policy_cache.cache[t->txpriv.rate_id].policy.version;
+		memcpy(t->desc->rates, t->tx_info->control.rates,
+		       sizeof(t->desc->rates));
+		t->desc->rate = t->rate;
+		t->desc->max_tx_rate = wsm->maxTxRate;
+		t->desc->ht_tx_params = wsm->htTxParameters;
+	}
+
 	if (tx_policy_renew) {
 		txrx_printk(XRADIO_DBG_MSG, "[TX] TX policy renew.\n");
-		/* It's not so optimal to stop TX queues every now and then.
-		 * Maybe it's better to reimplement task scheduling with
-		 * a counter. */
-		/* xradio_tx_queues_lock(priv); */
-		/* Definetly better. TODO. */
+		/* The frame waits in the queue until the upload is done. */
 		if (atomic_add_return(1, &hw_priv->upload_count) == 1) {
-			wsm_lock_tx_async(hw_priv);
 			if (queue_work(hw_priv->workqueue,
-				  &hw_priv->tx_policy_upload_work) <= 0) {
+				  &hw_priv->tx_policy_upload_work) <= 0)
 				atomic_set(&hw_priv->upload_count, 0);
-				wsm_unlock_tx(hw_priv);
-			}
 		}
 	}
 	return 0;
 }
 
 static bool
-xradio_tx_h_pm_state(struct xradio_vif *priv, struct xradio_txinfo *t)
+xradio_tx_h_pm_state(struct xradio_vif *priv, struct xradio_txpriv *txpriv)
 {
 	int was_buffered = 1;
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
-	if (t->txpriv.link_id == priv->link_id_after_dtim &&
+	if (txpriv->link_id == priv->link_id_after_dtim &&
 			!priv->buffered_multicasts) {
 		priv->buffered_multicasts = true;
 		if (priv->sta_asleep_mask)
@@ -1127,9 +1225,9 @@ xradio_tx_h_pm_state(struct xradio_vif *priv, struct xradio_txinfo *t)
 				&priv->multicast_start_work);
 	}
 
-	if (t->txpriv.raw_link_id && t->txpriv.tid < XRADIO_MAX_TID)
-		was_buffered = priv->link_id_db[t->txpriv.raw_link_id - 1]
-				.buffered[t->txpriv.tid]++;
+	if (txpriv->raw_link_id && txpriv->tid < XRADIO_MAX_TID)
+		was_buffered = priv->link_id_db[txpriv->raw_link_id - 1]
+				.buffered[txpriv->tid]++;
 
 	return !was_buffered;
 }
@@ -1139,24 +1237,27 @@ xradio_tx_h_ba_stat(struct xradio_vif *priv,
 		    struct xradio_txinfo *t)
 {
 	struct xradio_common *hw_priv = priv->hw_priv;
+	struct xradio_ba_tid *ba;
+	size_t len = t->skb->len - t->hdrlen;
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
-	if (priv->join_status != XRADIO_JOIN_STATUS_STA)
+	if (!ieee80211_is_data_qos(t->hdr->frame_control))
 		return;
-	if (!xradio_is_ht(&hw_priv->ht_oper))
-		return;
-	if (!priv->setbssparams_done)
+	if (t->txpriv.tid >= XRADIO_MAX_TID ||
+	    t->txpriv.raw_link_id > MAX_STA_IN_AP_MODE)
 		return;
-	if (!ieee80211_is_data(t->hdr->frame_control))
+	if (!xradio_ba_managed(priv))
 		return;
 
+	ba = &priv->ba_tid[t->txpriv.raw_link_id][t->txpriv.tid];
 	spin_lock_bh(&hw_priv->ba_lock);
-	hw_priv->ba_acc += t->skb->len - t->hdrlen;
-	if (!(hw_priv->ba_cnt_rx || hw_priv->ba_cnt)) {
+	hw_priv->ba_acc += len;
+	hw_priv->ba_cnt++;
+	ba->frames++;
+	ba->bytes += len;
+	if (!timer_pending(&hw_priv->ba_timer))
 		mod_timer(&hw_priv->ba_timer,
 			jiffies + XRADIO_BLOCK_ACK_INTERVAL);
-	}
-	hw_priv->ba_cnt++;
 	spin_unlock_bh(&hw_priv->ba_lock);
 }
 
@@ -1175,13 +1276,241 @@ xradio_tx_h_skb_pad(struct xradio_common *priv,
 	return 0;
 }
 
+/* ******************************************************************** */
+/* Airtime								*/
+
+/* WSM_TRANSMIT_RATE_... in 100 kbps. */
+static const u16 xradio_hw_rate_100kbps[] = {
+	10, 20, 55, 110, 220, 330,			/* DSSS/CCK */
+	60, 90, 120, 180, 240, 360, 480, 540,		/* OFDM */
+	65, 130, 195, 260, 390, 520, 585, 650,		/* HT MCS0-7 */
+};
+
+/* One attempt at hw_rate, 0 for an unknown rate. */
+static u32 xradio_airtime_attempt(int hw_rate, u32 len)
+{
+	u32 overhead;
+
+	if (hw_rate < 0 || hw_rate >= ARRAY_SIZE(xradio_hw_rate_100kbps))
+		return 0;
+	overhead = (hw_rate < WSM_TRANSMIT_RATE_6) ?
+		XRADIO_AIRTIME_DSSS_OVERHEAD : XRADIO_AIRTIME_OFDM_OVERHEAD;
+	return overhead + len * 80 / xradio_hw_rate_100kbps[hw_rate];
+}
+
+/* All attempts of a confirmed frame: rate_try[] holds the failed tries
+ * per hw rate in nibbles, the last one is at txedRate if acked. */
+static u32 xradio_airtime_confirm(const struct wsm_tx_confirm *arg, u32 len)
+{
+	u32 airtime = 0;
+	int i, j, retries;
+
+	for (i = 0; i < ARRAY_SIZE(arg->rate_try); i++) {
+		for (j = 0; arg->rate_try[i] && j < 8; j++) {
+			retries = (arg->rate_try[i] >> (j << 2)) & 0xf;
+			airtime += retries *
+				xradio_airtime_attempt((i << 3) + j, len);
+		}
+	}
+	if (!arg->status)
+		airtime += xradio_airtime_attempt(arg->txedRate, len);
+	if (!airtime)
+		airtime = (arg->ackFailures + 1) *
+			xradio_airtime_attempt(arg->txedRate, len);
+	return airtime;
+}
+
+/* Rates that should get through a clean medium, up to 13 Mbps. */
+#define XRADIO_RTS_ROBUST_100KBPS	(130)
+
+static void xradio_rts_update(struct xradio_vif *priv)
+{
+	struct xradio_rts *rts = &priv->rts;
+	u32 ms = jiffies_to_msecs(min_t(unsigned long, jiffies - rts->start,
+					2 * XRADIO_RTS_INTERVAL));
+	bool enabled = rts->enabled;
+
+	if (enabled) {
+		rts->bytes_on += rts->bytes;
+		rts->ms_on += ms;
+	} else {
+		rts->bytes_off += rts->bytes;
+		rts->ms_off += ms;
+	}
+
+	if (rts->tries >= XRADIO_RTS_MIN_TRIES) {
+		rts->fail_pct = rts->fails * 100 / rts->tries;
+		if (rts->fail_pct >= XRADIO_RTS_DIRTY_PCT) {
+			rts->clean = 0;
+			if (++rts->dirty >= XRADIO_RTS_HIST)
+				enabled = true;
+		} else if (rts->fail_pct < XRADIO_RTS_CLEAN_PCT) {
+			rts->dirty = 0;
+			if (++rts->clean >= XRADIO_RTS_HOLD)
+				enabled = false;
+		}
+	}
+	if (!priv->hw_priv->rts_auto)
+		enabled = false;
+
+	if (enabled != rts->enabled) {
+		rts->enabled = enabled;
+		rts->dirty = 0;
+		rts->clean = 0;
+		rts->switches++;
+		queue_work(priv->hw_priv->workqueue, &priv->rts_work);
+	}
+	rts->start = jiffies;
+	rts->tries = 0;
+	rts->fails = 0;
+	rts->bytes = 0;
+}
+
+/* Count the tries of a data frame at robust rates, see XRADIO_RTS_*. */
+static void xradio_rts_tx_status(struct xradio_vif *priv,
+				 const struct wsm_tx_confirm *arg, u32 len)
+{
+	struct xradio_rts *rts = &priv->rts;
+	int hw_rate, tries;
+
+	if (!priv->hw_priv->rts_auto && !rts->enabled)
+		return;
+	if (time_after(jiffies, rts->start + XRADIO_RTS_INTERVAL))
+		xradio_rts_update(priv);
+
+	for (hw_rate = 0; hw_rate < ARRAY_SIZE(xradio_hw_rate_100kbps); ++hw_rate) {
+		if (xradio_hw_rate_100kbps[hw_rate] > XRADIO_RTS_ROBUST_100KBPS)
+			continue;
+		tries = (arg->rate_try[hw_rate >> 3] >> ((hw_rate & 7) << 2)) & 0xf;
+		rts->tries += tries;
+		rts->fails += tries;
+	}
+	if (!arg->status) {
+		rts->bytes += len;
+		if (arg->txedRate < ARRAY_SIZE(xradio_hw_rate_100kbps) &&
+		    xradio_hw_rate_100kbps[arg->txedRate] <=
+		    XRADIO_RTS_ROBUST_100KBPS)
+			rts->tries++;
+	}
+}
+
+void xradio_airtime_reset(struct xradio_common *hw_priv, int if_id,
+			  int link_id)
+{
+	struct xradio_airtime *at = &hw_priv->airtime[if_id][link_id];
+
+	spin_lock_bh(&hw_priv->airtime_lock);
+	at->deficit = 0;
+	at->pending = 0;
+	at->used = 0;
+	/* Start from 6 Mbps, the first confirms correct it quickly. */
+	at->us_per_kb = xradio_airtime_attempt(WSM_TRANSMIT_RATE_6, 1024);
+	spin_unlock_bh(&hw_priv->airtime_lock);
+}
+
+/* Account the expected airtime of a frame entering the driver queue. */
+static void xradio_airtime_queue(struct xradio_common *hw_priv,
+				 struct xradio_txpriv *txpriv, u32 len)
+{
+	struct xradio_airtime *at =
+		&hw_priv->airtime[txpriv->if_id][txpriv->raw_link_id];
+
+	spin_lock_bh(&hw_priv->airtime_lock);
+	txpriv->airtime = min_t(u32, len * at->us_per_kb >> 10, U16_MAX);
+	at->pending += txpriv->airtime;
+	spin_unlock_bh(&hw_priv->airtime_lock);
+}
+
+/* The frame left driver and firmware, whether sent or dropped. */
+static void xradio_airtime_release(struct xradio_common *hw_priv,
+				   const struct xradio_txpriv *txpriv)
+{
+	struct xradio_airtime *at =
+		&hw_priv->airtime[txpriv->if_id][txpriv->raw_link_id];
+	bool unblocked;
+
+	spin_lock_bh(&hw_priv->airtime_lock);
+	unblocked = at->pending > XRADIO_AQL_LIMIT;
+	at->pending -= min_t(u32, at->pending, txpriv->airtime);
+	unblocked = unblocked && at->pending <= XRADIO_AQL_LIMIT;
+	spin_unlock_bh(&hw_priv->airtime_lock);
+
+	/* Its TXQs may wait for this in xradio_txq_schedule(). */
+	if (unblocked)
+		xradio_bh_wakeup(hw_priv);
+}
+
+/* Charge the airtime really used and learn the cost per byte. */
+static void xradio_airtime_report(struct xradio_common *hw_priv,
+				  const struct xradio_txpriv *txpriv,
+				  u32 airtime, u32 len)
+{
+	struct xradio_airtime *at =
+		&hw_priv->airtime[txpriv->if_id][txpriv->raw_link_id];
+
+	if (!len)
+		return;
+	spin_lock_bh(&hw_priv->airtime_lock);
+	at->deficit -= airtime;
+	at->used += airtime;
+	at->us_per_kb = (7 * at->us_per_kb + (airtime << 10) / len) >> 3;
+	spin_unlock_bh(&hw_priv->airtime_lock);
+}
+
 /* ******************************************************************** */
 #if (defined(CONFIG_XRADIO_DEBUG))
 u16  txparse_flags = 0;//PF_DHCP|PF_8021X|PF_MGMT;
 u16  rxparse_flags = 0;//PF_DHCP|PF_8021X|PF_MGMT;
 #endif
 
-void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, struct sk_buff *skb)
+/* Frames of one mac80211 TXQ on their way into the driver queue. */
+struct xradio_tx_batch {
+	struct xradio_vif *priv;
+	unsigned queue;
+	int count;
+	struct sk_buff *skb[XRADIO_TXQ_BURST];
+	struct xradio_txpriv txpriv[XRADIO_TXQ_BURST];
+};
+
+/* Queue a batch with one round of the PS state, queue and stats locks. */
+static void xradio_tx_batch_put(struct xradio_common *hw_priv,
+				struct xradio_tx_batch *batch,
+				struct ieee80211_sta *sta)
+{
+	struct xradio_vif *priv = batch->priv;
+	u8 tid_update = 0;
+	int i, n;
+
+	if (!batch->count)
+		return;
+
+	spin_lock_bh(&priv->ps_state_lock);
+	for (i = 0; i < batch->count; i++) {
+		if (xradio_tx_h_pm_state(priv, &batch->txpriv[i]))
+			tid_update |= BIT(batch->txpriv[i].tid);
+	}
+	n = xradio_queue_put_batch(&hw_priv->tx_queue[batch->queue],
+			batch->skb, batch->txpriv, batch->count);
+	spin_unlock_bh(&priv->ps_state_lock);
+
+	/* Out of queue items, drop what didn't fit. */
+	for (i = max(n, 0); i < batch->count; i++)
+		xradio_skb_dtor(hw_priv, batch->skb[i], &batch->txpriv[i]);
+
+#if defined(CONFIG_XRADIO_USE_EXTENSIONS)
+	for (i = 0; sta && tid_update; i++, tid_update >>= 1) {
+		if (tid_update & 1)
+			ieee80211_sta_set_buffered(sta, i, true);
+	}
+#endif /* CONFIG_XRADIO_USE_EXTENSIONS */
+	batch->count = 0;
+}
+
+/* With @batch the frame is only prepared and added to it, the caller
+ * queues it with xradio_tx_batch_put(). */
+static void __xradio_tx(struct ieee80211_hw *dev,
+			struct ieee80211_tx_control *control,
+			struct sk_buff *skb, struct xradio_tx_batch *batch)
 {
 	struct xradio_common *hw_priv = dev->priv;
 	struct xradio_txinfo t = {
@@ -1236,8 +1565,7 @@ void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, s
 	if (txparse_flags){
 		u8 temp_iv_len ;
 		if(t.tx_info->control.hw_key && 
-			 (t.hdr->frame_control & __cpu_to_le32(IEEE80211_FCTL_PROTECTED)) &&
-			 	(t.tx_info->control.hw_key->cipher == WLAN_CIPHER_SUITE_CCMP))
+			 (t.hdr->frame_control & __cpu_to_le32(IEEE80211_FCTL_PROTECTED)))
 			temp_iv_len = t.tx_info->control.hw_key->iv_len;
 		else
 			temp_iv_len =0;
@@ -1250,14 +1578,17 @@ void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, s
 	if (ieee80211_is_auth(frame->frame_control)) {
 		hw_priv->connet_time[priv->if_id] = jiffies;
 	} else if (ieee80211_is_data_present(frame->frame_control)) {
-		/* since Umac had already alloc IV space in ccmp skb, so we need to add this iv_len as the new offset to LLC */
+		/* since Umac had already alloc IV space in the skb, so we need to add this iv_len as the new offset to LLC */
 		u8* llc = NULL;
 		if(t.tx_info->control.hw_key && 
-		  	(t.hdr->frame_control & __cpu_to_le32(IEEE80211_FCTL_PROTECTED)) &&
-		  		(t.tx_info->control.hw_key->cipher == WLAN_CIPHER_SUITE_CCMP))
+		  	(t.hdr->frame_control & __cpu_to_le32(IEEE80211_FCTL_PROTECTED)))
 			llc = skb->data+ieee80211_hdrlen(frame->frame_control) + t.tx_info->control.hw_key->iv_len;
 		else
 			llc = skb->data+ieee80211_hdrlen(frame->frame_control);
+		/* Look at the first subframe, see xradio_amsdu_build(). */
+		if (ieee80211_is_data_qos(frame->frame_control) &&
+		    (*ieee80211_get_qos_ctl(frame) & IEEE80211_QOS_CTL_A_MSDU_PRESENT))
+			llc += sizeof(struct ethhdr);
 		if (is_dhcp(llc) || is_8021x(llc)) {
 			t.txpriv.use_bg_rate = 
 			hw_priv->hw->wiphy->bands[hw_priv->channel->band]->bitrates[0].hw_value;
@@ -1268,10 +1599,19 @@ void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, s
 		if (t.txpriv.use_bg_rate){
 			hw_priv->connet_time[priv->if_id] = jiffies;
 		}
+		if (is_8021x(llc))
+			t.txpriv.fast_lane = XRADIO_FAST_LANE_EAPOL;
+		else if (is_dhcp(llc))
+			t.txpriv.fast_lane = XRADIO_FAST_LANE_DHCP;
+		else if (t.queue == IEEE80211_AC_VO)
+			t.txpriv.fast_lane = XRADIO_FAST_LANE_VOICE;
 	} else if (ieee80211_is_deauth(frame->frame_control) ||
 	           ieee80211_is_disassoc(frame->frame_control)) {
 		hw_priv->connet_time[priv->if_id] = 0;
 	}
+	if (ieee80211_is_mgmt(frame->frame_control))
+		t.txpriv.fast_lane = XRADIO_FAST_LANE_MGMT;
+	t.txpriv.fast_lane &= hw_priv->fast_lane_mask;
 
 #ifdef AP_HT_COMPAT_FIX
 	if (ieee80211_is_assoc_req(frame->frame_control) && 
@@ -1311,24 +1651,9 @@ void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, s
 		goto drop;
 	}
 
-	//spin_lock_bh(&hw_priv->tx_queue[t.queue].lock);
-	//if ((priv->if_id == 0) &&
-	//	(hw_priv->tx_queue[t.queue].num_queued_vif[0] >=
-	//		hw_priv->vif0_throttle)) {
-	//	spin_unlock_bh(&hw_priv->tx_queue[t.queue].lock);
-	//	
-	//	ret = __LINE__;
-	//	goto drop;
-	//} else if ((priv->if_id == 1) &&
-	//	(hw_priv->tx_queue[t.queue].num_queued_vif[1] >=
-	//		hw_priv->vif1_throttle)) {
-	//	spin_unlock_bh(&hw_priv->tx_queue[t.queue].lock);
-	//	
-	//	ret = __LINE__;
-	//	goto drop;
-	//}
-	//spin_unlock_bh(&hw_priv->tx_queue[t.queue].lock);
-
+	xradio_tx_h_calc_tid(priv, &t);
+	if (batch)
+		xradio_tx_h_desc(hw_priv, control, &t);
 	ret = xradio_tx_h_calc_link_ids(priv, control, &t);
 	if (ret) {
 		ret = __LINE__;
@@ -1341,7 +1666,6 @@ void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, s
 			t.txpriv.raw_link_id);
 
 	xradio_tx_h_pm(priv, &t);
-	xradio_tx_h_calc_tid(priv, &t);
 	ret = xradio_tx_h_crypt(priv, &t);
 	if (ret) {
 		ret = __LINE__;
@@ -1378,22 +1702,40 @@ void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, s
 		ret = __LINE__;
 		goto drop;
 	}
+	if (t.desc && !t.desc_hit) {
+		t.desc->queue = t.queue;
+		t.desc->gen = t.desc_gen;
+	}
 
 	rcu_read_lock();
 	sta = rcu_dereference(control->sta);
 
 	xradio_tx_h_ba_stat(priv, &t);
+	xradio_airtime_queue(hw_priv, &t.txpriv, t.skb->len - t.txpriv.offset);
+	if (batch) {
+		batch->priv = priv;
+		batch->queue = t.queue;
+		batch->skb[batch->count] = t.skb;
+		batch->txpriv[batch->count++] = t.txpriv;
+		rcu_read_unlock();
+		return;
+	}
 	spin_lock_bh(&priv->ps_state_lock);
 	{
-		tid_update = xradio_tx_h_pm_state(priv, &t);
-		SYS_BUG(xradio_queue_put(&hw_priv->tx_queue[t.queue],
-				t.skb, &t.txpriv));
+		tid_update = xradio_tx_h_pm_state(priv, &t.txpriv);
+		ret = xradio_queue_put(&hw_priv->tx_queue[t.queue],
+				t.skb, &t.txpriv);
 #ifdef ROC_DEBUG
 		txrx_printk(XRADIO_DBG_ERROR, "QPUT %x, %pM, if_id - %d\n",
 			t.hdr->frame_control, t.da, priv->if_id);
 #endif
 	}
 	spin_unlock_bh(&priv->ps_state_lock);
+	if (ret) {
+		rcu_read_unlock();
+		ret = __LINE__;
+		goto drop;
+	}
 
 #if defined(CONFIG_XRADIO_USE_EXTENSIONS)
 	if (tid_update && sta)
@@ -1413,6 +1755,11 @@ drop:
 	return;
 }
 
+void xradio_tx(struct ieee80211_hw *dev, struct ieee80211_tx_control *control, struct sk_buff *skb)
+{
+	__xradio_tx(dev, control, skb, NULL);
+}
+
 /* ******************************************************************** */
 
 static int xradio_handle_pspoll(struct xradio_vif *priv,
@@ -1471,6 +1818,73 @@ extern u32 tx_over_limit;
 extern u32 tx_lower_limit;
 extern int retry_mis;
 
+/* Report the exact tries of a frame to rate control. rate_try[] holds
+ * the failed tries per hw rate in nibbles and the firmware walks the
+ * policy from the highest rate down, so the tries are reported in that
+ * order against the rates mac80211 asked for. Returns the failed tries. */
+static u32 xradio_tx_status_rates(struct xradio_common *hw_priv,
+				  struct ieee80211_tx_info *tx,
+				  const struct wsm_tx_confirm *arg, u8 ht_flags)
+{
+	struct ieee80211_tx_rate req[IEEE80211_TX_MAX_RATES];
+	struct ieee80211_tx_rate *rates = tx->status.rates;
+	const struct ieee80211_rate *rate;
+	s8 hw_value[IEEE80211_TX_MAX_RATES];
+	int i, n = 0, hw_rate, tries;
+	u32 failed = 0;
+
+	memcpy(req, rates, sizeof(req));
+	for (i = 0; i < IEEE80211_TX_MAX_RATES; ++i) {
+		rate = req[i].idx >= 0 ? xradio_get_tx_rate(hw_priv, &req[i]) : NULL;
+		hw_value[i] = rate ? rate->hw_value : -1;
+		if (!rate)
+			break;
+	}
+	for (; i < IEEE80211_TX_MAX_RATES; ++i)
+		hw_value[i] = -1;
+
+	for (hw_rate = ARRAY_SIZE(arg->rate_try) * 8 - 1; hw_rate >= 0; --hw_rate) {
+		tries = (arg->rate_try[hw_rate >> 3] >> ((hw_rate & 7) << 2)) & 0xf;
+		failed += tries;
+		if (!arg->status && hw_rate == arg->txedRate)
+			tries++;
+		if (!tries || n >= IEEE80211_TX_MAX_RATES)
+			continue;
+
+		for (i = 0; i < IEEE80211_TX_MAX_RATES; ++i) {
+			if (hw_value[i] == hw_rate)
+				break;
+		}
+		if (i < IEEE80211_TX_MAX_RATES) {
+			rates[n] = req[i];
+			hw_value[i] = -1;
+		} else {
+			/* Not asked for, e.g. a nearest or debug policy. */
+			rates[n].flags = hw_rate >= hw_priv->mcs_rates[0].hw_value ?
+					 IEEE80211_TX_RC_MCS : 0;
+			rates[n].idx = xradio_get_rate_idx(hw_priv,
+						rates[n].flags, hw_rate);
+			if (rates[n].idx < 0)
+				continue;
+		}
+		rates[n].count = tries;
+		if (rates[n].flags & IEEE80211_TX_RC_MCS)
+			rates[n].flags |= ht_flags;
+		n++;
+	}
+
+	if (!n) {
+		rates[0] = req[0];
+		rates[0].count = arg->ackFailures + 1;
+		n = 1;
+	}
+	for (i = n; i < IEEE80211_TX_MAX_RATES; ++i) {
+		rates[i].idx = -1;
+		rates[i].count = 0;
+	}
+	return failed;
+}
+
 void xradio_tx_confirm_cb(struct xradio_common *hw_priv,
 			  struct wsm_tx_confirm *arg)
 {
@@ -1609,7 +2023,6 @@ void xradio_tx_confirm_cb(struct xradio_common *hw_priv,
 			queue, arg->packetID, &skb, &txpriv))) {
 		struct ieee80211_tx_info *tx = IEEE80211_SKB_CB(skb);
 		struct ieee80211_hdr *frame = (struct ieee80211_hdr *)&skb->data[txpriv->offset];
-		int tx_count = arg->ackFailures;
 		u8 ht_flags = 0;
 		int i;
 
@@ -1652,10 +2065,13 @@ void xradio_tx_confirm_cb(struct xradio_common *hw_priv,
 			spin_unlock(&priv->bss_loss_lock);
 		}
 
+		if (ieee80211_is_data_qos(frame->frame_control))
+			xradio_ba_tx_status(priv, txpriv, !arg->status,
+				arg->flags & WSM_TX_STATUS_AGGREGATION);
+
 		if (likely(!arg->status)) {
 			tx->flags |= IEEE80211_TX_STAT_ACK;
 			priv->cqm_tx_failure_count = 0;
-			++tx_count;
 			if (arg->txedRate<24)
 				TxedRateIdx_Map[arg->txedRate]++;
 			else
@@ -1676,120 +2092,23 @@ void xradio_tx_confirm_cb(struct xradio_common *hw_priv,
 				queue_work(hw_priv->workqueue,
 						&priv->tx_failure_work);
 			}
-			if (tx_count)
-				++tx_count;
 		}
 		spin_unlock(&priv->vif_lock);
 
 		tx->status.ampdu_len = 1;
 		tx->status.ampdu_ack_len = 1;
 
-#if 0
-		tx_count = arg->ackFailures+1;
-		for (i = 0; i < IEEE80211_TX_MAX_RATES; ++i) {
-			if (tx->status.rates[i].count >= tx_count) {
-				tx->status.rates[i].count = tx_count;
-				if(likely(!arg->status)) {
-						s8 txed_idx = xradio_get_rate_idx(hw_priv, tx->status.rates[i].flags,
-						                                  arg->txedRate);
-						//if(txed_idx != tx->status.rates[i].idx) {
-						//	tx_policy_err++;
-						//}
-						//tx->status.rates[i].idx = (txed_idx >=0)?
-						//	                         txed_idx:tx->status.rates[i].idx;
-						if(tx->status.rates[i].idx != txed_idx) {
-							if(i<(IEEE80211_TX_MAX_RATES-1)) {
-								i++;
-								tx->status.rates[i].idx   = txed_idx;
-								tx->status.rates[i].count = 1;
-							} else if(txed_idx >=0) {
-								tx->status.rates[i].idx   = txed_idx;
-								tx->status.rates[i].count = 1;
-							}
-						}
-				}
-				break;
-			}
-			tx_count -= tx->status.rates[i].count;
-			if (tx->status.rates[i].flags & IEEE80211_TX_RC_MCS)
-				tx->status.rates[i].flags |= ht_flags;
-		}
-
-		for (++i; i < IEEE80211_TX_MAX_RATES; ++i) {
-			tx->status.rates[i].count = 0;
-			tx->status.rates[i].idx = -1;
-		}
-		
-#else
-		txrx_printk(XRADIO_DBG_NIY,"feedback:%08x, %08x, %08x.\n", 
+		txrx_printk(XRADIO_DBG_NIY,"feedback:%08x, %08x, %08x.\n",
 				         arg->rate_try[2], arg->rate_try[1], arg->rate_try[0]);
 		if(txpriv->use_bg_rate) {   //bg rates
 			tx->status.rates[0].count = arg->ackFailures+1;
-		  tx->status.rates[0].idx   = 0;
-		  tx->status.rates[1].idx   = -1;
-		  tx->status.rates[2].idx   = -1;
-		  tx->status.rates[3].idx   = -1;
-		  tx->status.rates[4].idx   = -1;
-		} else {
-			int j;
-			s8  txed_idx;
-			register u8 rate_num=0, shift=0, retries=0;
-			u8  flag = tx->status.rates[0].flags;
-			
-			//get retry rate idx.
-			for(i=2; i>=0;i--) {
-				if(arg->rate_try[i]) {
-					for(j=7; j>=0;j--) {
-						shift   = j<<2;
-						retries = (arg->rate_try[i]>>shift)&0xf;
-						if(retries) {
-							feedback_retry += retries;
-							txed_idx = xradio_get_rate_idx(hw_priv,flag,((i<<3)+j));
-							txrx_printk(XRADIO_DBG_NIY, "rate_num=%d, hw=%d, idx=%d, "
-							            "retries=%d, flag=%d", rate_num, ((i<<3)+j), 
-							            txed_idx, retries, flag);
-							if(likely(txed_idx>=0)) {
-								tx->status.rates[rate_num].idx   = txed_idx;
-								tx->status.rates[rate_num].count = retries;
-								if (tx->status.rates[rate_num].flags & IEEE80211_TX_RC_MCS)
-									tx->status.rates[rate_num].flags |= ht_flags;
-								rate_num++;
-								if(rate_num>=IEEE80211_TX_MAX_RATES) {
-									i = -1;
-									break;
-								}
-							}
-						}
-					}
-				}
-			}
-			//clear other rate.
-			for (i=rate_num; i < IEEE80211_TX_MAX_RATES; ++i) {
-				tx->status.rates[i].count = 0;
+			tx->status.rates[0].idx   = 0;
+			for (i = 1; i < IEEE80211_TX_MAX_RATES; ++i)
 				tx->status.rates[i].idx = -1;
-			}
-			//get successful rate idx.
-			if(!arg->status) {
-				txed_idx = xradio_get_rate_idx(hw_priv, flag, arg->txedRate);
-				if(rate_num == 0) {
-					tx->status.rates[0].idx = txed_idx;
-					tx->status.rates[0].count = 1;
-				} else if(rate_num <= IEEE80211_TX_MAX_RATES){
-					--rate_num;
-					if(txed_idx == tx->status.rates[rate_num].idx) {
-						tx->status.rates[rate_num].count += 1;
-					} else if(rate_num<(IEEE80211_TX_MAX_RATES-1)){
-						++rate_num;
-						tx->status.rates[rate_num].idx   = txed_idx;
-						tx->status.rates[rate_num].count = 1;
-					} else if(txed_idx >=0) {
-						tx->status.rates[rate_num].idx   = txed_idx;
-						tx->status.rates[rate_num].count = 1;
-					}
-				}
-			} 
+		} else {
+			feedback_retry = xradio_tx_status_rates(hw_priv, tx, arg,
+								ht_flags);
 		}
-#endif
 
 #ifdef CONFIG_XRADIO_DEBUGFS
 		if (arg->status == WSM_STATUS_RETRY_EXCEEDED) {
@@ -1816,6 +2135,13 @@ void xradio_tx_confirm_cb(struct xradio_common *hw_priv,
 		tx->status.rates[2].idx, tx->status.rates[2].count,
 		tx->status.rates[3].idx, tx->status.rates[3].count,
 		tx->status.rates[4].idx, tx->status.rates[4].count);
+
+		xradio_airtime_report(hw_priv, txpriv,
+			xradio_airtime_confirm(arg, skb->len - txpriv->offset),
+			skb->len - txpriv->offset);
+		if (ieee80211_is_data(frame->frame_control))
+			xradio_rts_tx_status(priv, arg,
+					     skb->len - txpriv->offset);
 		
 #ifdef CONFIG_XRADIO_TESTMODE
 		xradio_queue_remove(hw_priv, queue, arg->packetID);
@@ -1856,6 +2182,450 @@ static void xradio_notify_buffered_tx(struct xradio_vif *priv,
 #endif /* CONFIG_XRADIO_USE_EXTENSIONS */
 }
 
+/* ******************************************************************** */
+/* mac80211 TXQs							*/
+
+/* Frames wait in the mac80211 TXQs, where mac80211 does per station and
+ * TID fair queuing, and are pulled into the driver queues only while
+ * those are below their byte limit. Only the BH pulls, so the driver
+ * queues see a single producer and take each burst as one batch. */
+
+static inline struct ieee80211_txq *xradio_txq_to_ieee80211(
+					struct xradio_txq *xtxq)
+{
+	return container_of((void *)xtxq, struct ieee80211_txq, drv_priv);
+}
+
+void xradio_txq_init(struct ieee80211_txq *txq)
+{
+	struct xradio_txq *xtxq;
+
+	if (!txq)
+		return;
+	xtxq = (struct xradio_txq *)txq->drv_priv;
+	INIT_LIST_HEAD(&xtxq->list);
+}
+
+void xradio_txq_unlink(struct xradio_common *hw_priv,
+		       struct ieee80211_txq *txq)
+{
+	struct xradio_txq *xtxq;
+
+	if (!txq)
+		return;
+	xtxq = (struct xradio_txq *)txq->drv_priv;
+	spin_lock_bh(&hw_priv->txq_lock);
+	list_del_init(&xtxq->list);
+	spin_unlock_bh(&hw_priv->txq_lock);
+}
+
+/* A-MSDU packing: frames pulled from one TXQ share RA and TID, so small
+ * MSDUs can share a WSM message and a firmware input buffer. */
+static size_t xradio_amsdu_iv_len(struct sk_buff *skb)
+{
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)skb->data;
+
+	if (!info->control.hw_key ||
+	    !ieee80211_has_protected(hdr->frame_control))
+		return 0;
+	return info->control.hw_key->iv_len;
+}
+
+static bool xradio_amsdu_check(struct sk_buff *skb)
+{
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)skb->data;
+	size_t hdrlen;
+	u8 *llc;
+
+	if (!ieee80211_is_data_qos(hdr->frame_control) ||
+	    !ieee80211_is_data_present(hdr->frame_control) ||
+	    ieee80211_has_a4(hdr->frame_control) ||
+	    ieee80211_has_morefrags(hdr->frame_control) ||
+	    is_multicast_ether_addr(hdr->addr1) ||
+	    skb_is_nonlinear(skb) ||
+	    (info->flags & (IEEE80211_TX_CTL_REQ_TX_STATUS |
+			    IEEE80211_TX_CTL_NO_ACK |
+			    IEEE80211_TX_CTL_RATE_CTRL_PROBE)))
+		return false;
+	if (*ieee80211_get_qos_ctl(hdr) & IEEE80211_QOS_CTL_A_MSDU_PRESENT)
+		return false;
+	/* HT does not allow TKIP or WEP. */
+	if (info->control.hw_key &&
+	    info->control.hw_key->cipher != WLAN_CIPHER_SUITE_CCMP)
+		return false;
+
+	hdrlen = ieee80211_hdrlen(hdr->frame_control) + xradio_amsdu_iv_len(skb);
+	if (skb->len < hdrlen + LLC_LEN)
+		return false;
+	/* Keep EAPOL and DHCP visible to __xradio_tx(). */
+	llc = skb->data + hdrlen;
+	return !is_8021x(llc) && !is_dhcp(llc);
+}
+
+/* Insert the first subframe header and flag the frame as an A-MSDU. */
+static bool xradio_amsdu_convert(struct sk_buff *head)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)head->data;
+	size_t len = ieee80211_hdrlen(hdr->frame_control) +
+		     xradio_amsdu_iv_len(head);
+	u8 da[ETH_ALEN], sa[ETH_ALEN];
+	struct ethhdr *eth;
+
+	/* WSM header and alignment still have to fit in front. */
+	if (skb_headroom(head) < sizeof(*eth) + WSM_TX_EXTRA_HEADROOM + 3)
+		return false;
+
+	memcpy(da, ieee80211_get_DA(hdr), ETH_ALEN);
+	memcpy(sa, ieee80211_get_SA(hdr), ETH_ALEN);
+	hdr = (struct ieee80211_hdr *)skb_push(head, sizeof(*eth));
+	memmove(hdr, (u8 *)hdr + sizeof(*eth), len);
+	eth = (struct ethhdr *)((u8 *)hdr + len);
+	memcpy(eth->h_dest, da, ETH_ALEN);
+	memcpy(eth->h_source, sa, ETH_ALEN);
+	eth->h_proto = cpu_to_be16(head->len - len - sizeof(*eth));
+
+	/* The outer DA (to DS) or SA (from DS) becomes the BSSID. */
+	if (ieee80211_has_tods(hdr->frame_control))
+		memcpy(hdr->addr3, hdr->addr1, ETH_ALEN);
+	else if (ieee80211_has_fromds(hdr->frame_control))
+		memcpy(hdr->addr3, hdr->addr2, ETH_ALEN);
+	*ieee80211_get_qos_ctl(hdr) |= IEEE80211_QOS_CTL_A_MSDU_PRESENT;
+	return true;
+}
+
+/* Append the MSDU of @skb to @head and free @skb, if it fits in @limit.
+ * @head is converted on the first call. */
+static bool xradio_amsdu_add(struct xradio_common *hw_priv,
+			     struct sk_buff *head, struct sk_buff *skb,
+			     size_t limit)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)skb->data;
+	struct ieee80211_hdr *head_hdr = (struct ieee80211_hdr *)head->data;
+	struct ieee80211_key_conf *key = IEEE80211_SKB_CB(head)->control.hw_key;
+	size_t icv_len = key ? key->icv_len : 0;
+	size_t off = ieee80211_hdrlen(hdr->frame_control) +
+		     xradio_amsdu_iv_len(skb);
+	size_t msdu_len = skb->len - off;
+	size_t len, pad, need;
+	struct ethhdr *eth;
+	bool first;
+
+	if (IEEE80211_SKB_CB(skb)->control.hw_key != key ||
+	    ieee80211_has_protected(hdr->frame_control) !=
+	    ieee80211_has_protected(head_hdr->frame_control))
+		return false;
+
+	first = !(*ieee80211_get_qos_ctl(head_hdr) &
+		  IEEE80211_QOS_CTL_A_MSDU_PRESENT);
+	len = head->len + (first ? sizeof(*eth) : 0);
+	/* Subframes but the last are padded to 4 bytes. */
+	pad = -(len - ieee80211_hdrlen(head_hdr->frame_control) -
+		xradio_amsdu_iv_len(head)) & 3;
+	need = pad + sizeof(*eth) + msdu_len;
+	if (len + need > limit)
+		return false;
+	if (first && !xradio_amsdu_convert(head))
+		return false;
+	if (skb_tailroom(head) < need + icv_len &&
+	    pskb_expand_head(head, 0, limit + icv_len - head->len,
+			     GFP_ATOMIC))
+		return false;
+
+	memset(skb_put(head, pad), 0, pad);
+	eth = (struct ethhdr *)skb_put(head, sizeof(*eth));
+	memcpy(eth->h_dest, ieee80211_get_DA(hdr), ETH_ALEN);
+	memcpy(eth->h_source, ieee80211_get_SA(hdr), ETH_ALEN);
+	eth->h_proto = cpu_to_be16(msdu_len);
+	memcpy(skb_put(head, msdu_len), skb->data + off, msdu_len);
+	ieee80211_free_txskb(hw_priv->hw, skb);
+	return true;
+}
+
+/* Packs the next frames of @txq into @head while they fit in a firmware
+ * input buffer. Returns a dequeued frame that did not, to be sent on its
+ * own. The frames absorbed leave their sequence numbers unused, which
+ * only a block ack receiver would wait for, so TIDs with TX block ack
+ * are not packed. That also keeps A-MSDUs out of firmware A-MPDUs, the
+ * peer's ADDBA is not known to allow them. */
+static struct sk_buff *xradio_amsdu_build(struct xradio_vif *priv,
+					  struct ieee80211_txq *txq,
+					  struct sk_buff *head)
+{
+	struct xradio_common *hw_priv = priv->hw_priv;
+	struct ieee80211_key_conf *key = IEEE80211_SKB_CB(head)->control.hw_key;
+	struct sk_buff *skb = NULL;
+	int limit, n = 1;
+
+	if (!hw_priv->amsdu_enable || !txq->sta ||
+	    !txq->sta->ht_cap.ht_supported || txq->tid >= XRADIO_MAX_TID ||
+	    (READ_ONCE(priv->ba_fw_mask) & BIT(txq->tid)) ||
+	    !xradio_amsdu_check(head))
+		return NULL;
+	limit = min_t(int, IEEE80211_MAX_MPDU_LEN_HT_3839,
+		      hw_priv->wsm_caps.sizeInpChBuf - sizeof(struct wsm_tx) -
+		      3 /* alignment */ - (key ? key->icv_len : 0));
+
+	while (n < XRADIO_AMSDU_MAX_SUBFRAMES) {
+		skb = ieee80211_tx_dequeue(hw_priv->hw, txq);
+		if (!skb)
+			break;
+		if (!xradio_amsdu_check(skb) ||
+		    !xradio_amsdu_add(hw_priv, head, skb, limit))
+			break;
+		skb = NULL;
+		n++;
+	}
+	if (n > 1)
+		xradio_debug_tx_amsdu(hw_priv, n);
+	return skb;
+}
+
+#define XRADIO_MDNS_PORT	(5353)
+
+/* mDNS goes to a link-local group, but is bulk service discovery rather
+ * than control traffic. */
+static bool xradio_mc_to_uc_mdns(struct sk_buff *skb, size_t off)
+{
+	struct udphdr *udph;
+
+	if (skb->len < off + sizeof(*udph))
+		return false;
+	udph = (struct udphdr *)(skb->data + off);
+	return udph->dest == htons(XRADIO_MDNS_PORT);
+}
+
+/* Multicast to unicast: an AP sends multicast data as one copy per
+ * station, each at the station's own rates with retries and power save
+ * buffering. IP multicast beyond link-local scope and mDNS count as
+ * data; broadcast, ARP, IGMP, MLD and neighbour discovery, and the
+ * other link-local groups, which carry routing protocols, stay
+ * multicast. */
+static bool xradio_mc_to_uc_check(struct sk_buff *skb)
+{
+	static const struct in6_addr mdns6 = {{{
+		0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xfb }}};
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)skb->data;
+	size_t off;
+	u8 *llc;
+
+	/* mac80211 sends group frames without QoS header, so the copies
+	 * keep the sequence number of the VIF they already carry. They
+	 * stay non-QoS data as well, which the firmware never puts in an
+	 * A-MPDU: the gain is rates, retries and power save, not
+	 * aggregation. */
+	if (!ieee80211_is_data(hdr->frame_control) ||
+	    ieee80211_is_data_qos(hdr->frame_control) ||
+	    !ieee80211_has_fromds(hdr->frame_control) ||
+	    ieee80211_has_a4(hdr->frame_control) ||
+	    ieee80211_has_morefrags(hdr->frame_control) ||
+	    !is_multicast_ether_addr(hdr->addr1) ||
+	    is_broadcast_ether_addr(hdr->addr1) ||
+	    skb_is_nonlinear(skb) ||
+	    (info->flags & IEEE80211_TX_CTL_REQ_TX_STATUS))
+		return false;
+
+	off = ieee80211_hdrlen(hdr->frame_control) +
+	      xradio_amsdu_iv_len(skb) + LLC_LEN;
+	if (skb->len < off)
+		return false;
+	llc = skb->data + off - LLC_LEN;
+	if (is_ip(llc)) {
+		struct iphdr *iph = (struct iphdr *)(skb->data + off);
+
+		if (skb->len < off + sizeof(*iph) ||
+		    !ipv4_is_multicast(iph->daddr) ||
+		    iph->protocol == IPPROTO_IGMP)
+			return false;
+		if (!ipv4_is_local_multicast(iph->daddr))
+			return true;
+		return iph->daddr == htonl(0xe00000fb) /* 224.0.0.251 */ &&
+		       iph->protocol == IPPROTO_UDP &&
+		       xradio_mc_to_uc_mdns(skb, off + iph->ihl * 4);
+	}
+	if (is_ipv6(llc)) {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)(skb->data + off);
+
+		if (skb->len < off + sizeof(*ip6h) ||
+		    !ipv6_addr_is_multicast(&ip6h->daddr) ||
+		    ip6h->nexthdr == IPPROTO_ICMPV6)
+			return false;
+		if (IPV6_ADDR_MC_SCOPE(&ip6h->daddr) >
+		    IPV6_ADDR_SCOPE_LINKLOCAL)
+			return true;
+		return ipv6_addr_equal(&ip6h->daddr, &mdns6) &&
+		       ip6h->nexthdr == IPPROTO_UDP &&
+		       xradio_mc_to_uc_mdns(skb, off + sizeof(*ip6h));
+	}
+	return false;
+}
+
+/* Sends @skb as unicast copies if every associated station, at most
+ * priv->mc_to_uc of them, can take one. Otherwise returns false and
+ * @skb stays multicast. Called under the RCU read lock. */
+static bool xradio_mc_to_uc(struct xradio_common *hw_priv,
+			    struct xradio_vif *priv, struct sk_buff *skb)
+{
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+	struct ieee80211_key_conf *key = info->control.hw_key;
+	struct ieee80211_key_conf *ptk[MAX_STA_IN_AP_MODE];
+	struct ieee80211_sta *sta[MAX_STA_IN_AP_MODE];
+	struct ieee80211_tx_control control = {};
+	struct xradio_queue *queue;
+	struct ieee80211_hdr *hdr;
+	struct sk_buff *copy;
+	u8 sa[ETH_ALEN];
+	int i, n = 0;
+
+	if (priv->mode != NL80211_IFTYPE_AP || !xradio_mc_to_uc_check(skb))
+		return false;
+
+	hdr = (struct ieee80211_hdr *)skb->data;
+	memcpy(sa, ieee80211_get_SA(hdr), ETH_ALEN);
+	for (i = 0; i < MAX_STA_IN_AP_MODE; i++) {
+		if (priv->link_id_db[i].status != XRADIO_LINK_HARD)
+			continue;
+		sta[n] = ieee80211_find_sta(priv->vif,
+					    priv->link_id_db[i].mac);
+		if (!sta[n])
+			return false;
+		/* Not back to the sender. */
+		if (ether_addr_equal(sta[n]->addr, sa))
+			continue;
+		if (n >= priv->mc_to_uc)
+			return false;
+		/* The firmware encrypts the copies with the pairwise key,
+		 * which has to fit the room mac80211 left for the group key.
+		 * Without one the station may not be authorized yet. */
+		ptk[n] = READ_ONCE(((struct xradio_sta_priv *)
+				    &sta[n]->drv_priv)->ptk);
+		if (key && (!ptk[n] || ptk[n]->cipher != key->cipher))
+			return false;
+		n++;
+	}
+	queue = &hw_priv->tx_queue[skb_get_queue_mapping(skb)];
+	if (!n || xradio_queue_room(queue) < n)
+		return false;
+
+	info->flags &= ~(IEEE80211_TX_CTL_NO_ACK |
+			 IEEE80211_TX_CTL_SEND_AFTER_DTIM);
+	priv->mc_to_uc_frames++;
+	for (i = 0; i < n; i++) {
+		/* The last station gets the original. */
+		copy = i + 1 < n ? skb_copy(skb, GFP_ATOMIC) : skb;
+		if (!copy)
+			continue;
+		hdr = (struct ieee80211_hdr *)copy->data;
+		info = IEEE80211_SKB_CB(copy);
+		memcpy(hdr->addr1, sta[i]->addr, ETH_ALEN);
+		if (key)
+			info->control.hw_key = ptk[i];
+		ieee80211_get_tx_rates(priv->vif, sta[i], copy,
+				       info->control.rates,
+				       ARRAY_SIZE(info->control.rates));
+		control.sta = sta[i];
+		__xradio_tx(hw_priv->hw, &control, copy, NULL);
+		priv->mc_to_uc_copies++;
+	}
+	return true;
+}
+
+/* Round robin over the active TXQs of an AC, XRADIO_TXQ_BURST frames
+ * at a time, skipping VIFs whose driver queue is stopped and links over
+ * their airtime limit, and weighted by the airtime each link used. */
+void xradio_txq_schedule(struct xradio_common *hw_priv, int ac)
+{
+	struct list_head *active = &hw_priv->txq_active[ac];
+	struct xradio_queue *queue = &hw_priv->tx_queue[ac];
+	struct ieee80211_tx_control control = {};
+	struct xradio_tx_batch batch;
+	struct ieee80211_txq *txq;
+	struct xradio_txq *xtxq;
+	struct xradio_vif *priv;
+	struct xradio_airtime *at;
+	struct sk_buff *skb = NULL, *next;
+	LIST_HEAD(stopped);
+	int i, room, link_id;
+
+	if (list_empty(active))
+		return;
+
+	rcu_read_lock();
+	spin_lock_bh(&hw_priv->txq_lock);
+	while (!list_empty(active)) {
+		xtxq = list_first_entry(active, struct xradio_txq, list);
+		txq = xradio_txq_to_ieee80211(xtxq);
+		priv = xrwl_get_vif_from_ieee80211(txq->vif);
+		link_id = txq->sta ?
+			((struct xradio_sta_priv *)&txq->sta->drv_priv)->link_id : 0;
+		at = &hw_priv->airtime[priv->if_id][link_id];
+		room = min_t(size_t, XRADIO_TXQ_BURST, xradio_queue_room(queue));
+		if (xradio_queue_stopped(queue, priv->if_id) || !room ||
+		    at->pending > XRADIO_AQL_LIMIT) {
+			list_move_tail(&xtxq->list, &stopped);
+			continue;
+		}
+
+		/* Airtime fairness between links. */
+		spin_lock_bh(&hw_priv->airtime_lock);
+		if (at->deficit < 0) {
+			at->deficit += XRADIO_AIRTIME_QUANTUM;
+			spin_unlock_bh(&hw_priv->airtime_lock);
+			list_move_tail(&xtxq->list, active);
+			continue;
+		}
+		spin_unlock_bh(&hw_priv->airtime_lock);
+
+		control.sta = txq->sta;
+		batch.count = 0;
+		next = NULL;
+		for (i = 0; i < room; i++) {
+			if (next) {
+				skb = next;
+				next = NULL;
+			} else {
+				skb = ieee80211_tx_dequeue(hw_priv->hw, txq);
+				if (!skb)
+					break;
+			}
+			/* Copies are queued one by one, after the batch. */
+			if (!txq->sta && priv->mc_to_uc) {
+				xradio_tx_batch_put(hw_priv, &batch, NULL);
+				if (xradio_mc_to_uc(hw_priv, priv, skb))
+					continue;
+			}
+			/* A frame left over by the packer takes the next slot. */
+			if (i + 1 < room)
+				next = xradio_amsdu_build(priv, txq, skb);
+			__xradio_tx(hw_priv->hw, &control, skb, &batch);
+		}
+		xradio_tx_batch_put(hw_priv, &batch, txq->sta);
+		if (!skb)
+			list_del_init(&xtxq->list);
+		else
+			list_move_tail(&xtxq->list, active);
+	}
+	list_splice(&stopped, active);
+	spin_unlock_bh(&hw_priv->txq_lock);
+	rcu_read_unlock();
+}
+
+void xradio_wake_tx_queue(struct ieee80211_hw *dev, struct ieee80211_txq *txq)
+{
+	struct xradio_common *hw_priv = dev->priv;
+	struct xradio_txq *xtxq = (struct xradio_txq *)txq->drv_priv;
+
+	spin_lock_bh(&hw_priv->txq_lock);
+	if (list_empty(&xtxq->list))
+		list_add_tail(&xtxq->list, &hw_priv->txq_active[txq->ac]);
+	spin_unlock_bh(&hw_priv->txq_lock);
+
+	/* Only the BH pulls from the TXQs, see wsm_get_tx(). */
+	xradio_bh_wakeup(hw_priv);
+}
+
 void xradio_skb_dtor(struct xradio_common *hw_priv,
 		     struct sk_buff *skb,
 		     const struct xradio_txpriv *txpriv)
@@ -1864,6 +2634,7 @@ void xradio_skb_dtor(struct xradio_common *hw_priv,
 		__xrwl_hwpriv_to_vifpriv(hw_priv, txpriv->if_id);
 	txrx_printk(XRADIO_DBG_TRC,"%s\n", __func__);
 
+	xradio_airtime_release(hw_priv, txpriv);
 	skb_pull(skb, txpriv->offset);
 	if (priv && txpriv->rate_id != XRADIO_INVALID_RATE_ID) {
 		xradio_notify_buffered_tx(priv, skb,
@@ -1969,10 +2740,9 @@ xradio_rx_h_ba_stat(struct xradio_vif *priv,
 
 	spin_lock_bh(&hw_priv->ba_lock);
 	hw_priv->ba_acc_rx += skb_len - hdrlen;
-	if (!(hw_priv->ba_cnt_rx || hw_priv->ba_cnt)) {
+	if (!timer_pending(&hw_priv->ba_timer))
 		mod_timer(&hw_priv->ba_timer,
 			jiffies + XRADIO_BLOCK_ACK_INTERVAL);
-	}
 	hw_priv->ba_cnt_rx++;
 	spin_unlock_bh(&hw_priv->ba_lock);
 }
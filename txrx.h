@@ -15,6 +15,7 @@
 #include <linux/list.h>
 
 /* extern */ struct ieee80211_hw;
+/* extern */ struct ieee80211_txq;
 /* extern */ struct sk_buff;
 /* extern */ struct wsm_tx;
 /* extern */ struct wsm_rx;
@@ -28,21 +29,29 @@ struct tx_policy {
 		u8 raw[12];
 	};
 	u8  defined;		/* TODO: u32 or u8, profile and select best */
-	u8  usage_count;	/* --// -- */
+	u16 usage_count;	/* frames queued or in flight */
 	u8  retry_count;	/* --// -- */
 	u8  uploaded;
+	u8  version;		/* bumped whenever the entry is reused */
 };
 
 struct tx_policy_cache_entry {
 	struct tx_policy policy;
 	struct list_head link;
+	struct hlist_node hnode;
 };
 
 #define TX_POLICY_CACHE_SIZE	(8)
+#define TX_POLICY_HASH_BITS	(4)
+#define TX_POLICY_UPLOAD_RETRY	(3)
 struct tx_policy_cache {
 	struct tx_policy_cache_entry cache[TX_POLICY_CACHE_SIZE];
+	struct hlist_head hash[1 << TX_POLICY_HASH_BITS];
 	struct list_head used;
-	struct list_head free;
+	struct list_head free;	/* idle entries, least recently used last */
+	u32 pending_map;	/* entries not yet uploaded to the device */
+	u32 failed_map;		/* of them, given up on, see tx_policy_fallback() */
+	u8 upload_retry;	/* failed uploads in a row */
 	spinlock_t lock;
 };
 
@@ -55,6 +64,10 @@ struct tx_policy_cache {
  */
 void tx_policy_init(struct xradio_common *hw_priv);
 void tx_policy_upload_work(struct work_struct *work);
+bool tx_policy_ready(struct xradio_common *hw_priv, int idx);
+bool tx_policy_fallback(struct xradio_common *hw_priv, struct sk_buff *skb,
+			struct xradio_txpriv *txpriv);
+void xradio_tx_desc_flush(struct xradio_common *hw_priv);
 
 /* ******************************************************************** */
 /* TX implementation							*/
@@ -66,6 +79,21 @@ void xradio_skb_dtor(struct xradio_common *hw_priv,
 		     struct sk_buff *skb,
 		     const struct xradio_txpriv *txpriv);
 
+/* ******************************************************************** */
+/* mac80211 TXQs							*/
+
+struct xradio_txq {
+	struct list_head list;	/* txq_active of the AC */
+};
+
+void xradio_wake_tx_queue(struct ieee80211_hw *dev, struct ieee80211_txq *txq);
+void xradio_txq_init(struct ieee80211_txq *txq);
+void xradio_txq_unlink(struct xradio_common *hw_priv,
+		       struct ieee80211_txq *txq);
+void xradio_txq_schedule(struct xradio_common *hw_priv, int ac);
+void xradio_airtime_reset(struct xradio_common *hw_priv, int if_id,
+			  int link_id);
+
 /* ******************************************************************** */
 /* WSM callbacks							*/
 
@@ -90,7 +90,8 @@ static int wsm_cmd_send(struct xradio_common *hw_priv,
 			void *arg, u16 cmd, long tmo, int if_id);
 
 static struct xradio_vif
-	*wsm_get_interface_for_tx(struct xradio_common *hw_priv);
+	*wsm_get_interface_for_tx(struct xradio_common *hw_priv, u32 *tried);
+static void wsm_vif_tx_charge(struct xradio_common *hw_priv, int if_id);
 
 static inline void wsm_cmd_lock(struct xradio_common *hw_priv)
 {
@@ -1790,6 +1791,7 @@ int wsm_cmd_send(struct xradio_common *hw_priv,
 {
 	size_t buf_len = buf->data - buf->begin;
 	int ret;
+	int waits = 0;
 
 	if (cmd == 0x0006 || cmd == 0x0005) /* Write/Read MIB */
 		wsm_printk(XRADIO_DBG_MSG, ">>> 0x%.4X [MIB: 0x%.4X] (%d)\n",
@@ -1835,6 +1837,8 @@ int wsm_cmd_send(struct xradio_common *hw_priv,
 	hw_priv->wsm_cmd.len = buf_len;
 	hw_priv->wsm_cmd.arg = arg;
 	hw_priv->wsm_cmd.cmd = cmd;
+	hw_priv->wsm_cmd.pending = true;
+	hw_priv->wsm_cmd.start = ktime_get();
 	spin_unlock(&hw_priv->wsm_cmd.lock);
 
 	xradio_bh_wakeup(hw_priv);
@@ -1860,12 +1864,18 @@ int wsm_cmd_send(struct xradio_common *hw_priv,
 		do {
 			/* It's safe to use unprotected access to wsm_cmd.done here */
 			ret = wait_event_timeout(hw_priv->wsm_cmd_wq, hw_priv->wsm_cmd.done, tmo);
+			++waits;
 
 			/* check time since last rxed and max timeout.*/
 		} while (!ret && 
 		         time_before_eq(jiffies, hw_priv->rx_timestamp+tmo) && 
 		         time_before(jiffies, wsm_cmd_max_tmo));
 
+		xradio_debug_wsm_cmd(hw_priv, cmd,
+		                     __le16_to_cpu(((__le16 *)buf->begin)[2]),
+		                     ktime_us_delta(ktime_get(),
+		                                    hw_priv->wsm_cmd.start),
+		                     waits - 1, !ret);
 	}
 
 	if (unlikely(ret == 0)) {
@@ -1875,6 +1885,7 @@ int wsm_cmd_send(struct xradio_common *hw_priv,
 		raceCheck = hw_priv->wsm_cmd.cmd;
 		hw_priv->wsm_cmd.arg = NULL;
 		hw_priv->wsm_cmd.ptr = NULL;
+		hw_priv->wsm_cmd.pending = false;
 		spin_unlock(&hw_priv->wsm_cmd.lock);
 
 		wsm_printk(XRADIO_DBG_ERROR,
@@ -2304,6 +2315,7 @@ int wsm_handle_rx(struct xradio_common *hw_priv, int id,
 			spin_lock(&hw_priv->wsm_cmd.lock);
 			hw_priv->wsm_cmd.ret = *((u16 *)(wsm_buf.data) + 1);
 			hw_priv->wsm_cmd.done = 1;
+			hw_priv->wsm_cmd.pending = false;
 			spin_unlock(&hw_priv->wsm_cmd.lock);
 			wake_up(&hw_priv->wsm_cmd_wq);
 			wsm_printk(XRADIO_DBG_ALWY, "HWT TestID=0x%x Confirm ret=%d\n", 
@@ -2449,6 +2461,7 @@ int wsm_handle_rx(struct xradio_common *hw_priv, int id,
 		spin_lock(&hw_priv->wsm_cmd.lock);
 		hw_priv->wsm_cmd.ret = ret;
 		hw_priv->wsm_cmd.done = 1;
+		hw_priv->wsm_cmd.pending = false;
 		spin_unlock(&hw_priv->wsm_cmd.lock);
 		ret = 0; /* Error response from device should ne stop BH. */
 
@@ -2807,51 +2820,84 @@ static bool wsm_handle_tx_data(struct xradio_vif *priv,
 	return handled;
 }
 
+/* Airtime granted to an AC per round: the EDCA access probability goes
+ * roughly with 1/(AIFSN + CWmin + 1), so VO > VI > BE > BK by default
+ * and whatever the AP advertises otherwise. */
+static s32 xradio_edca_quantum(const struct wsm_edca_queue_params *edca)
+{
+	return (XRADIO_EDCA_QUANTUM << 4) / (edca->aifns + edca->cwMin + 1);
+}
+
 static int xradio_get_prio_queue(struct xradio_vif *priv,
-				 u32 link_id_map, int *total)
+				 u32 link_id_map, u8 ac_skip, int *total)
 {
 	struct xradio_common *hw_priv = xrwl_vifpriv_to_hwpriv(priv);
-	static u32 urgent;
-	struct wsm_edca_queue_params *edca;
-	unsigned score, best = -1;
-	int winner = -1;
-	int queued;
+	u32 urgent = BIT(priv->link_id_after_dtim) | BIT(priv->link_id_uapsd);
+	int burst_idx = hw_priv->tx_burst_idx;
+	u32 backlog = 0;
 	int i;
-	urgent = BIT(priv->link_id_after_dtim) | BIT(priv->link_id_uapsd);
-
-	/* search for a winner using edca params */
-	for (i = 0; i < 4; ++i) {
-		queued = xradio_queue_get_num_queued(priv,
-				&hw_priv->tx_queue[i],
-				link_id_map);
-		if (!queued)
-			continue;
-		*total += queued;
-		edca = &priv->edca.params[i];
-		score = ((edca->aifns + edca->cwMin) << 16) +
-				(edca->cwMax - edca->cwMin) *
-				(prandom_u32() & 0xFFFF);
-		if (score < best && (winner < 0 || i != 3)) {
-			best = score;
-			winner = i;
+
+	for (i = 0; i < AC_QUEUE_NUM; ++i) {
+		if (xradio_queue_backlog(&hw_priv->tx_queue[i],
+					 priv->if_id, link_id_map))
+			backlog |= BIT(i);
+	}
+	backlog &= ~ac_skip;
+	if (!backlog)
+		return -1;
+
+	if (total) {
+		for (i = 0; i < AC_QUEUE_NUM; ++i) {
+			if (backlog & BIT(i))
+				*total += xradio_queue_get_num_queued(priv,
+						&hw_priv->tx_queue[i],
+						link_id_map);
 		}
 	}
 
-	/* override winner if bursting */
-	if (winner >= 0 && hw_priv->tx_burst_idx >= 0 &&
-			winner != hw_priv->tx_burst_idx &&
-			!xradio_queue_get_num_queued(priv,
-				&hw_priv->tx_queue[winner],
-				link_id_map & urgent) &&
-			xradio_queue_get_num_queued(priv,
-				&hw_priv->tx_queue[hw_priv->tx_burst_idx],
-				link_id_map))
-		winner = hw_priv->tx_burst_idx;
+	/* The fast lane goes first and ends any burst in progress. */
+	for (i = 0; i < AC_QUEUE_NUM; ++i) {
+		if ((backlog & BIT(i)) && xradio_queue_fast_backlog(
+				&hw_priv->tx_queue[i], priv->if_id,
+				link_id_map)) {
+			if (i != burst_idx)
+				hw_priv->tx_burst_idx = -1;
+			return i;
+		}
+	}
 
-	return winner;
+	/* Stay on the bursting AC while its TXOP lasts, unless frames
+	 * for the DTIM or U-APSD link wait elsewhere. */
+	if (burst_idx >= 0 && (backlog & BIT(burst_idx)) &&
+	    hw_priv->tx_burst_budget > 0) {
+		for (i = 0; i < AC_QUEUE_NUM; ++i) {
+			if (i != burst_idx && xradio_queue_backlog(
+					&hw_priv->tx_queue[i], priv->if_id,
+					link_id_map & urgent))
+				break;
+		}
+		if (i == AC_QUEUE_NUM)
+			return burst_idx;
+	}
+
+	/* Deficit round robin weighted by the EDCA parameters. An AC is
+	 * served while its deficit is positive and pays for each frame
+	 * with the airtime estimate, see wsm_get_tx(). */
+	for (;;) {
+		i = priv->edca_rr;
+		if (!(backlog & BIT(i)))
+			priv->edca_deficit[i] = 0;
+		else if (priv->edca_deficit[i] > 0)
+			return i;
+		else
+			priv->edca_deficit[i] +=
+				xradio_edca_quantum(&priv->edca.params[i]);
+		priv->edca_rr = (i + 1) % AC_QUEUE_NUM;
+	}
 }
 
 static int wsm_get_tx_queue_and_mask(struct xradio_vif *priv,
+				     u8 ac_skip,
 				     struct xradio_queue **queue_p,
 				     u32 *tx_allowed_mask_p,
 				     bool *more)
@@ -2865,7 +2911,7 @@ static int wsm_get_tx_queue_and_mask(struct xradio_vif *priv,
 	if (priv->tx_multicast) {
 		tx_allowed_mask = BIT(priv->link_id_after_dtim);
 		idx = xradio_get_prio_queue(priv,
-				tx_allowed_mask, &total);
+				tx_allowed_mask, ac_skip, &total);
 		if (idx >= 0) {
 			*more = total > 1;
 			goto found;
@@ -2882,7 +2928,7 @@ static int wsm_get_tx_queue_and_mask(struct xradio_vif *priv,
 		tx_allowed_mask |= BIT(priv->link_id_after_dtim);
 	}
 	idx = xradio_get_prio_queue(priv,
-			tx_allowed_mask, &total);
+			tx_allowed_mask, ac_skip, NULL);
 	if (idx < 0)
 		return -ENOENT;
 
@@ -2901,10 +2947,8 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 	int queue_num;
 	u32 tx_allowed_mask = 0;
 	struct xradio_txpriv *txpriv = NULL;
-#ifdef P2P_MULTIVIF
-	int first = 1;
-	int tmp_if_id = -1;
-#endif
+	u32 vif_tried = 0;
+	u32 ac_skip = 0;	/* per VIF, nothing to get for now */
 	/*
 	 * Count was intended as an input for wsm->more flag.
 	 * During implementation it was found that wsm->more
@@ -2912,11 +2956,6 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 	 * in case you would like to try to implement it again.
 	 */
 	int count = 0;
-#ifdef P2P_MULTIVIF
-	int if_pending = XRWL_MAX_VIFS - 1;
-#else
-	int if_pending = 1;
-#endif
 
 	/* More is used only for broadcasts. */
 	bool more = false;
@@ -2935,6 +2974,10 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 		*vif_selected = -1;
 		spin_unlock(&hw_priv->wsm_cmd.lock);
 	} else {
+		/* Refill the driver queues from the mac80211 TXQs. */
+		for (queue_num = 0; queue_num < AC_QUEUE_NUM; ++queue_num)
+			xradio_txq_schedule(hw_priv, queue_num);
+
 		for (;;) {
 			int ret;
 			struct xradio_vif *priv;
@@ -2949,51 +2992,18 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 			if (hw_priv->hw_bufs_used >=
 					hw_priv->wsm_caps.numInpChBufs)
 				break;
-#ifdef P2P_MULTIVIF
-			if (first) {
-				tmp_if_id = hw_priv->if_id_selected;
-				hw_priv->if_id_selected = 2;
-			}
-#endif
-			priv = wsm_get_interface_for_tx(hw_priv);
-			/* go to next interface ID to select next packet */
-#ifdef P2P_MULTIVIF
-			if (first) {
-				hw_priv->if_id_selected = tmp_if_id;
-				first = 0;
-			} else
-#endif
-				hw_priv->if_id_selected ^= 1;
-
-			/* There might be no interface before add_interface
-			 * call */
-			if (!priv) {
-				if (if_pending) {
-#ifdef P2P_MULTIVIF
-					if_pending--;
-#else
-					if_pending = 0;
-#endif
-					continue;
-				}
+			/* Command priority: don't bury a pending confirm
+			 * behind more data in firmware. */
+			if (hw_priv->cmd_prio_enable &&
+			    hw_priv->wsm_cmd.pending &&
+			    hw_priv->hw_bufs_used > hw_priv->cmd_prio_tx_bufs) {
+				xradio_debug_cmd_prio_tx_held(hw_priv);
 				break;
 			}
-
-#if 0
-			if (((priv->if_id == 0) &&
-			(hw_priv->hw_bufs_used_vif[0] >=
-						XRWL_FW_VIF0_THROTTLE)) ||
-			((priv->if_id == 1) &&
-			(hw_priv->hw_bufs_used_vif[1] >=
-						XRWL_FW_VIF1_THROTTLE))) {
-				spin_unlock(&priv->vif_lock);
-				if (if_pending) {
-					if_pending = 0;
-					continue;
-				}
+			priv = wsm_get_interface_for_tx(hw_priv, &vif_tried);
+			/* No interface left with frames and buffer credit */
+			if (!priv)
 				break;
-			}
-#endif
 
 			/* This can be removed probably: xradio_vif will not
 			 * be in hw_priv->vif_list (as returned from
@@ -3007,8 +3017,9 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 			/* TODO:COMBO: Find the next interface for which
 			* packet needs to be found */
 			spin_lock_bh(&priv->ps_state_lock);
-			ret = wsm_get_tx_queue_and_mask(priv, &queue,
-					&tx_allowed_mask, &more);
+			ret = wsm_get_tx_queue_and_mask(priv,
+					ac_skip >> (priv->if_id * AC_QUEUE_NUM),
+					&queue, &tx_allowed_mask, &more);
 			queue_num = queue - hw_priv->tx_queue;
 
 			if (priv->buffered_multicasts &&
@@ -3027,27 +3038,19 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 
 			if (ret) {
 				spin_unlock(&priv->vif_lock);
-#ifdef P2P_MULTIVIF
-				if (if_pending) {
-#else
-				if (if_pending == 1) {
-#endif
-#ifdef P2P_MULTIVIF
-					if_pending--;
-#else
-					if_pending = 0;
-#endif
-					continue;
-				}
-				break;
+				continue;
 			}
 
 			if (xradio_queue_get(queue,
 					priv->if_id,
 					tx_allowed_mask,
 					&wsm, &tx_info, &txpriv)) {
+				/* E.g. frames waiting for a rate policy
+				 * upload, other ACs may still have some. */
+				ac_skip |= BIT(xradio_hw_queue(priv->if_id,
+							       queue_num));
+				vif_tried &= ~BIT(priv->if_id);
 				spin_unlock(&priv->vif_lock);
-				if_pending = 0;
 				continue;
 			}
 
@@ -3081,9 +3084,10 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 
 			if (wsm_handle_tx_data(priv, wsm,
 					tx_info, txpriv, queue)) {
+				/* Handled by WSM, the VIF may have more */
+				vif_tried &= ~BIT(priv->if_id);
 				spin_unlock(&priv->vif_lock);
-				if_pending = 0;
-				continue;  /* Handled by WSM */
+				continue;
 			}
 
 			wsm->hdr.id &= __cpu_to_le16(
@@ -3137,11 +3141,26 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 			*data = (u8 *)wsm;
 			*tx_len = __le16_to_cpu(wsm->hdr.len);
 
-			/* allow bursting if txop is set */
-			if (priv->edca.params[queue_num].txOpLimit)
-				*burst = min(*burst,
+			/* charge the EDCA scheduler */
+			priv->edca_deficit[queue_num] -=
+				txpriv->airtime ?: XRADIO_EDCA_MIN_CHARGE;
+
+			/* allow bursting if txop is set, for as many frames
+			 * as fit into the TXOP airtime left */
+			if (hw_priv->tx_burst_idx != queue_num)
+				hw_priv->tx_burst_budget =
+					priv->edca.params[queue_num].txOpLimit;
+			hw_priv->tx_burst_budget -=
+				txpriv->airtime ?: XRADIO_EDCA_MIN_CHARGE;
+			if (hw_priv->cmd_prio_enable && hw_priv->wsm_cmd.pending)
+				*burst = 1;
+			else if (hw_priv->tx_burst_budget > 0)
+				*burst = min3(*burst,
 					(int)xradio_queue_get_num_queued(priv,
-						queue, tx_allowed_mask) + 1);
+						queue, tx_allowed_mask) + 1,
+					hw_priv->tx_burst_budget /
+					(int)(txpriv->airtime ?:
+					      XRADIO_EDCA_MIN_CHARGE) + 1);
 			else
 				*burst = 1;
 
@@ -3172,6 +3191,7 @@ int wsm_get_tx(struct xradio_common *hw_priv, u8 **data,
 			wsm_printk(XRADIO_DBG_MSG, ">>> 0x%.4X (%d) %p %c\n",
 				0x0004, *tx_len, *data,
 				wsm->more ? 'M' : ' ');
+			wsm_vif_tx_charge(hw_priv, priv->if_id);
 			++count;
 			spin_unlock(&priv->vif_lock);
 			break;
@@ -3187,6 +3207,8 @@ void wsm_txed(struct xradio_common *hw_priv, u8 *data)
 		spin_lock(&hw_priv->wsm_cmd.lock);
 		hw_priv->wsm_cmd.ptr = NULL;
 		spin_unlock(&hw_priv->wsm_cmd.lock);
+		xradio_debug_cmd_txed(hw_priv,
+			ktime_us_delta(ktime_get(), hw_priv->wsm_cmd.start));
 	}
 }
 
@@ -3240,31 +3262,112 @@ static int wsm_buf_reserve(struct wsm_buf *buf, size_t extra_size)
 	}
 }
 
+static int wsm_vif_tx_share(struct xradio_common *hw_priv, int if_id,
+			    int weight)
+{
+	return max(1, (int)hw_priv->wsm_caps.numInpChBufs *
+		   hw_priv->vif_weight[if_id] / weight);
+}
+
+/* A VIF may always fill its weighted share of the firmware input
+ * buffers. Beyond that it only borrows buffers which no other VIF with
+ * frames queued could still claim for its own share.
+ * Called with vif_list_lock held. */
+static bool wsm_vif_tx_credit(struct xradio_common *hw_priv, int if_id)
+{
+	int weight = 0, reserved = 0;
+	int i, q;
+
+	for (i = 0; i < XRWL_MAX_VIFS; ++i) {
+		if (hw_priv->vif_list[i])
+			weight += hw_priv->vif_weight[i];
+	}
+
+	if (hw_priv->hw_bufs_used_vif[if_id] <
+			wsm_vif_tx_share(hw_priv, if_id, weight))
+		return true;
+
+	for (i = 0; i < XRWL_MAX_VIFS; ++i) {
+		if (i == if_id || !hw_priv->vif_list[i])
+			continue;
+		for (q = 0; q < AC_QUEUE_NUM; ++q) {
+			if (xradio_queue_backlog(&hw_priv->tx_queue[q], i, ~0))
+				break;
+		}
+		if (q == AC_QUEUE_NUM)
+			continue;
+		reserved += max(0, wsm_vif_tx_share(hw_priv, i, weight) -
+				hw_priv->hw_bufs_used_vif[i]);
+	}
+	return hw_priv->hw_bufs_used + reserved <
+		hw_priv->wsm_caps.numInpChBufs;
+}
+
+/* Weighted round robin: if_id_selected keeps being served while its
+ * deficit lasts, see wsm_vif_tx_charge(). VIFs already tried in this
+ * wsm_get_tx() call are set in @tried. Returns the VIF locked. */
 static struct xradio_vif 
-	*wsm_get_interface_for_tx(struct xradio_common *hw_priv)
+	*wsm_get_interface_for_tx(struct xradio_common *hw_priv, u32 *tried)
 {
-	struct xradio_vif *priv = NULL, *i_priv;
-	int i = hw_priv->if_id_selected;
+	struct xradio_vif *priv = NULL;
+	int i = -1;
+	int n;
 
-	if ( 1 /*TODO:COMBO*/) {
-		spin_lock(&hw_priv->vif_list_lock);
-		i_priv = hw_priv->vif_list[i] ? 
-		         xrwl_get_vif_from_ieee80211(hw_priv->vif_list[i]) : NULL;
-		if (i_priv) {
-			priv = i_priv;
-			spin_lock(&priv->vif_lock);
+	spin_lock(&hw_priv->vif_list_lock);
+#ifdef P2P_MULTIVIF
+	/* The generic interface goes first, as before. */
+	if (!(*tried & BIT(XRWL_GENERIC_IF_ID)) &&
+	    hw_priv->vif_list[XRWL_GENERIC_IF_ID] &&
+	    wsm_vif_tx_credit(hw_priv, XRWL_GENERIC_IF_ID))
+		i = XRWL_GENERIC_IF_ID;
+#endif
+	/* A VIF with fast lane frames goes first. */
+	for (n = 0; i < 0 && n < XRWL_MAX_VIFS; ++n) {
+		int q;
+
+		if ((*tried & BIT(n)) || !hw_priv->vif_list[n])
+			continue;
+		for (q = 0; q < AC_QUEUE_NUM; ++q) {
+			if (xradio_queue_fast_backlog(&hw_priv->tx_queue[q],
+						      n, ~0))
+				break;
 		}
-		/* TODO:COMBO:
-		* Find next interface based on TX bitmap announced by the FW
-		* Find next interface based on load balancing */
-		spin_unlock(&hw_priv->vif_list_lock);
-	} else {
-		priv = xrwl_hwpriv_to_vifpriv(hw_priv, 0);
+		if (q < AC_QUEUE_NUM && wsm_vif_tx_credit(hw_priv, n))
+			i = n;
+	}
+	for (n = 0; i < 0 && n < XRWL_MAX_VIFS; ++n) {
+		int j = hw_priv->if_id_selected;
+
+		if (!(*tried & BIT(j)) && hw_priv->vif_list[j] &&
+		    wsm_vif_tx_credit(hw_priv, j)) {
+			if (hw_priv->vif_deficit[j] <= 0)
+				hw_priv->vif_deficit[j] +=
+					hw_priv->vif_weight[j];
+			i = j;
+			break;
+		}
+		hw_priv->vif_deficit[j] = 0;
+		hw_priv->if_id_selected = (j + 1) % XRWL_MAX_VIFS;
 	}
+	if (i >= 0) {
+		*tried |= BIT(i);
+		priv = xrwl_get_vif_from_ieee80211(hw_priv->vif_list[i]);
+		spin_lock(&priv->vif_lock);
+	}
+	spin_unlock(&hw_priv->vif_list_lock);
 
 	return priv;
 }
 
+/* A frame of @if_id went to the firmware. */
+static void wsm_vif_tx_charge(struct xradio_common *hw_priv, int if_id)
+{
+	if (if_id != hw_priv->if_id_selected)
+		return;
+	if (--hw_priv->vif_deficit[if_id] <= 0)
+		hw_priv->if_id_selected = (if_id + 1) % XRWL_MAX_VIFS;
+}
+
 static inline int get_interface_id_scanning(struct xradio_common *hw_priv)
 {
 	if (hw_priv->scan.req || hw_priv->scan.direct_probe)
@@ -29,14 +29,22 @@
 #define XRWL_MAX_VIFS        (2)
 #endif
 #define XRWL_GENERIC_IF_ID   (2)
-#define XRWL_HOST_VIF0_11N_THROTTLE   (58)  //(XRWL_MAX_QUEUE_SZ/(XRWL_MAX_VIFS-1))*0.9
-#define XRWL_HOST_VIF1_11N_THROTTLE   (58)  //(XRWL_MAX_QUEUE_SZ/(XRWL_MAX_VIFS-1))*0.9
-#define XRWL_HOST_VIF0_11BG_THROTTLE  (35)  //XRWL_HOST_VIF0_11N_THROTTLE*0.6 = 35
-#define XRWL_HOST_VIF1_11BG_THROTTLE  (35)  //XRWL_HOST_VIF0_11N_THROTTLE*0.6 = 35
-#if 0
-#define XRWL_FW_VIF0_THROTTLE         (15)
-#define XRWL_FW_VIF1_THROTTLE         (15)
-#endif
+/* mac80211 hw queues: one per AC per VIF, plus a shared one for
+ * off-channel and after-DTIM frames. */
+#define XRWL_HW_QUEUES       (XRWL_MAX_VIFS * AC_QUEUE_NUM + 1)
+#define XRWL_SHARED_HW_QUEUE (XRWL_MAX_VIFS * AC_QUEUE_NUM)
+/* Byte limits of the host TX queues, per AC and per VIF, adapted to the
+ * bytes confirmed every XRWL_BQL_INTERVAL so that the backlog drains
+ * in about XRWL_BQL_TARGET. */
+#define XRWL_BQL_INTERVAL    (HZ / 10)
+#define XRWL_BQL_TARGET      (HZ / 50)
+#define XRWL_BQL_MIN_LIMIT   (4 * 1600)
+#define XRWL_BQL_MAX_LIMIT   (256 * 1024)
+/* Flow queuing with CoDel inside the host TX queues. */
+#define XRWL_FQ_FLOWS        (64)
+#define XRWL_FQ_QUANTUM      (1514)
+#define XRWL_CODEL_TARGET    (5)    /* ms */
+#define XRWL_CODEL_INTERVAL  (100)  /* ms */
 
 #define IEEE80211_FCTL_WEP      0x4000
 #define IEEE80211_QOS_DATAGRP   0x0080
@@ -68,6 +76,37 @@
 
 #define XRADIO_MAX_STA_IN_AP_MODE   (5)
 #define XRADIO_MAX_REQUEUE_ATTEMPTS (5)
+#define XRADIO_CMD_PRIO_RX_BURST    (2)
+#define XRADIO_CMD_PRIO_TX_BUFS     (4)
+#define XRADIO_TXQ_BURST            (4)
+#define XRADIO_AMSDU_MAX_SUBFRAMES  (8)
+/* Frames per round an interface may send, and its share of the
+ * firmware input buffers, are proportional to its weight. */
+#define XRADIO_VIF_WEIGHT           (1)
+#define XRADIO_VIF_WEIGHT_MAX       (16)
+/* Fast lane classes, their frames go to the firmware before all other
+ * frames of the interface and cut ongoing TXOP bursts short. A link may
+ * send XRADIO_FAST_LANE_VO_BUDGET VO data frames that way between two
+ * of its other frames, then VO waits its turn in the flows. */
+#define XRADIO_FAST_LANE_MGMT       BIT(0)
+#define XRADIO_FAST_LANE_EAPOL      BIT(1)
+#define XRADIO_FAST_LANE_DHCP       BIT(2)
+#define XRADIO_FAST_LANE_VOICE      BIT(3)
+#define XRADIO_FAST_LANE_DEFAULT    (XRADIO_FAST_LANE_MGMT  | \
+                                     XRADIO_FAST_LANE_EAPOL | \
+                                     XRADIO_FAST_LANE_DHCP  | \
+                                     XRADIO_FAST_LANE_VOICE)
+#define XRADIO_FAST_LANE_VO_BUDGET  (4)
+/* Airtime in us: DRR quantum per link, limit of airtime queued in
+ * driver and firmware per link (AQL), per attempt overheads. */
+#define XRADIO_AIRTIME_QUANTUM      (300)
+#define XRADIO_AQL_LIMIT            (8000)
+#define XRADIO_AIRTIME_DSSS_OVERHEAD (320)
+#define XRADIO_AIRTIME_OFDM_OVERHEAD (80)
+/* EDCA scheduler: airtime in us granted per AC and round is this
+ * quantum scaled by 16/(AIFSN + CWmin), charge for unknown frames. */
+#define XRADIO_EDCA_QUANTUM         (1024)
+#define XRADIO_EDCA_MIN_CHARGE      (50)
 #define XRADIO_LINK_ID_UNMAPPED     (15)
 #define XRADIO_MAX_TID              (8)
 
@@ -82,6 +121,22 @@
 #define XRADIO_BLOCK_ACK_THLD   (800)
 #define XRADIO_BLOCK_ACK_HIST   (3)
 #define XRADIO_BLOCK_ACK_INTERVAL	(1 * HZ / XRADIO_BLOCK_ACK_HIST)
+/* TX aggregation of a TID is dropped after XRADIO_BLOCK_ACK_HIST
+ * intervals with this share of failed frames, or with no A-MPDU at all,
+ * and not retried for XRADIO_BLOCK_ACK_BACKOFF intervals. */
+#define XRADIO_BLOCK_ACK_FAIL_PCT	(30)
+#define XRADIO_BLOCK_ACK_BACKOFF	(10 * XRADIO_BLOCK_ACK_HIST)
+/* Dynamic RTS/CTS: tries failing at robust rates look like hidden node
+ * collisions rather than a weak link. RTS goes on for frames above
+ * XRADIO_RTS_THRESHOLD after XRADIO_RTS_HIST such intervals and off
+ * after XRADIO_RTS_HOLD clean ones. */
+#define XRADIO_RTS_INTERVAL		(1 * HZ)
+#define XRADIO_RTS_MIN_TRIES		(20)
+#define XRADIO_RTS_DIRTY_PCT		(30)
+#define XRADIO_RTS_CLEAN_PCT		(10)
+#define XRADIO_RTS_HIST			(3)
+#define XRADIO_RTS_HOLD			(10)
+#define XRADIO_RTS_THRESHOLD		(512)
 #define XRWL_ALL_IFS           (-1)
 
 #ifdef ROAM_OFFLOAD
@@ -205,10 +260,62 @@ struct xradio_start_stop_tsm {
 };
 
 #endif /* CONFIG_XRADIO_TESTMODE */
+
+/* Airtime of a link, in us. */
+struct xradio_airtime {
+	s32 deficit;	/* airtime fairness DRR */
+	u32 pending;	/* estimate of frames not confirmed yet */
+	u32 us_per_kb;	/* EWMA cost of 1024 bytes, for the estimate */
+	u64 used;
+};
+
+/* TX block ack state of a link and TID, see xradio_ba_timer(). */
+struct xradio_ba_tid {
+	u32 frames;	/* queued this interval */
+	u32 bytes;
+	u32 tx_done;	/* confirmed this interval */
+	u32 tx_agg;	/* of them sent in an A-MPDU */
+	u32 tx_fail;
+	u32 total_done;
+	u32 total_agg;
+	u8 idle;	/* intervals without sustained traffic */
+	u8 fails;	/* intervals with failing aggregation */
+	u8 backoff;	/* intervals before it may be enabled again */
+	bool active;
+};
+
+/* Dynamic RTS/CTS of an interface, see xradio_rts_tx_status(). */
+struct xradio_rts {
+	unsigned long start;	/* of the interval */
+	u32 tries;		/* at robust rates this interval */
+	u32 fails;
+	u32 bytes;		/* acked this interval */
+	u8 dirty;		/* intervals in a row with collisions */
+	u8 clean;		/* intervals in a row without */
+	u8 fail_pct;		/* of the last interval with traffic */
+	bool enabled;
+	u32 threshold;		/* set in the firmware */
+	u32 switches;
+	u64 bytes_on;		/* goodput with and without RTS */
+	u64 bytes_off;
+	u32 ms_on;
+	u32 ms_off;
+};
+
 struct xradio_common {
 	struct xradio_debug_common	*debug;
 	struct xradio_queue		tx_queue[AC_QUEUE_NUM];
 	struct xradio_queue_stats	tx_queue_stats;
+	/* mac80211 TXQs with frames, per AC. */
+	struct list_head		txq_active[AC_QUEUE_NUM];
+	spinlock_t			txq_lock;
+	struct xradio_airtime		airtime[XRWL_MAX_VIFS][WLAN_LINK_ID_MAX];
+	spinlock_t			airtime_lock;
+	/* Flow queuing with CoDel in tx_queue, times in jiffies. */
+	bool				fq_codel_enable;
+	unsigned long			fq_codel_target;
+	unsigned long			fq_codel_interval;
+	bool				tcp_ack_filter;
 
 	struct ieee80211_hw		*hw;
 	struct mac_address		addresses[XRWL_MAX_VIFS];
@@ -265,7 +372,6 @@ struct xradio_common {
 	int				ba_cnt; /*TODO: Same as above */
 	int				ba_cnt_rx; /*TODO: Same as above */
 	int				ba_acc_rx; /*TODO: Same as above */
-	int				ba_hist; /*TODO: Same as above */
 	struct timer_list		ba_timer;/*TODO: Same as above */
 	spinlock_t			ba_lock; /*TODO: Same as above */
 	bool				ba_ena; /*TODO: Same as above */
@@ -325,6 +431,13 @@ struct xradio_common {
 	struct semaphore		tx_lock_sem;
 	atomic_t				tx_lock;
 	u32				pending_frame_id;
+	/* Command priority mode: while a command is pending, BH reads
+	 * at most cmd_prio_rx_burst frames in a row before sending it and
+	 * keeps at most cmd_prio_tx_bufs data frames in firmware until
+	 * its confirm is received. */
+	bool				cmd_prio_enable;
+	u8				cmd_prio_rx_burst;
+	u8				cmd_prio_tx_bufs;
 #ifdef CONFIG_XRADIO_TESTMODE
 	/* Device Power Range */
 	struct wsm_tx_power_range       txPowerRange[2];
@@ -356,6 +469,7 @@ struct xradio_common {
 	struct tx_policy_cache tx_policy_cache;
 	struct work_struct tx_policy_upload_work;
 	atomic_t upload_count;
+	atomic_t tx_desc_gen;	/* bumped to drop all cached TX descriptors */
 
 	/* cryptographic engine information */
 
@@ -367,6 +481,11 @@ struct xradio_common {
 
 	struct xradio_ht_oper		ht_oper;
 	int				tx_burst_idx;
+	int				tx_burst_budget; /* TXOP us left */
+	u8				fast_lane_mask;  /* XRADIO_FAST_LANE_* */
+	bool				amsdu_enable;
+	bool				rts_auto;
+	u32				rts_threshold;  /* from mac80211, 0 is off */
 
 	struct ieee80211_iface_limit		if_limits1[2];
 	struct ieee80211_iface_limit		if_limits2[2];
@@ -381,7 +500,9 @@ struct xradio_common {
 	wait_queue_head_t		offchannel_wq;
 	u16				offchannel_done;
 	u16				prev_channel;
-	int       if_id_selected;
+	int       if_id_selected;  /* VIF being served by wsm_get_tx */
+	u8				vif_weight[XRWL_MAX_VIFS];
+	int				vif_deficit[XRWL_MAX_VIFS]; /* frames */
 	u32				key_map;
 	struct wsm_add_key		keys[WSM_KEY_MAX_INDEX + 1];
 #ifdef MCAST_FWDING
@@ -407,8 +528,6 @@ struct xradio_common {
 	struct xradio_start_stop_tsm	start_stop_tsm;
 #endif /* CONFIG_XRADIO_TESTMODE */
 	u8          connected_sta_cnt;
-	u16			vif0_throttle;
-	u16			vif1_throttle;
 };
 
 /* Virtual Interface State. One copy per VIF */
@@ -421,6 +540,8 @@ struct xradio_vif {
 	/* BBP/MAC state */
 	u8 bssid[ETH_ALEN];
 	struct wsm_edca_params		edca;
+	s32				edca_deficit[AC_QUEUE_NUM]; /* us */
+	u8				edca_rr;
 	struct wsm_tx_queue_params	tx_queue_params;
 	struct wsm_association_mode	association_mode;
 	struct wsm_set_bss_params	bss_params;
@@ -500,6 +621,11 @@ struct xradio_vif {
 	spinlock_t		ps_state_lock;
 	bool			buffered_multicasts;
 	bool			tx_multicast;
+	/* Multicast data to at most this many stations goes as unicast
+	 * copies, 0 for off. */
+	u8			mc_to_uc;
+	u32			mc_to_uc_frames;
+	u32			mc_to_uc_copies;
 	u8     last_tim[8];   //for softap dtim, add by yangfh
 	struct work_struct	set_tim_work;
 	struct delayed_work	set_cts_work;
@@ -511,6 +637,8 @@ struct xradio_vif {
 	struct delayed_work	bss_loss_work;
 	struct delayed_work	connection_loss_work;
 	struct work_struct	tx_failure_work;
+	struct xradio_rts	rts;
+	struct work_struct	rts_work;
 	int			delayed_link_loss;
 	spinlock_t		bss_loss_lock;
 	int			bss_loss_status;
@@ -529,6 +657,10 @@ struct xradio_vif {
 	u8			action_linkid;
 #endif
 	bool			htcap;
+	/* TX block ack per link and TID, under hw_priv->ba_lock. */
+	struct xradio_ba_tid	ba_tid[MAX_STA_IN_AP_MODE + 1][XRADIO_MAX_TID];
+	u8			ba_tx_mask;	/* TIDs wanted */
+	u8			ba_fw_mask;	/* TIDs set, under conf_mutex */
 #ifdef  AP_HT_CAP_UPDATE
         u16                     ht_oper;
         struct work_struct      ht_oper_update_work;
@@ -539,9 +671,28 @@ struct xradio_vif {
 	u16    ht_compat_det;
 #endif
 };
+/* TX setup of the last data frame on a TID, see xradio_tx_h_desc(). */
+struct xradio_tx_desc {
+	u32 gen;		/* valid while equal to hw_priv->tx_desc_gen */
+	u8 queue;
+	u8 link_id;
+	u8 raw_link_id;
+	u8 iv_len;
+	u8 icv_len;
+	u8 rate_id;
+	u8 rate_version;
+	u8 max_tx_rate;
+	__le32 ht_tx_params;
+	struct ieee80211_key_conf *key;
+	const struct ieee80211_rate *rate;
+	struct ieee80211_tx_rate rates[IEEE80211_TX_MAX_RATES];
+};
+
 struct xradio_sta_priv {
 	int link_id;
 	struct xradio_vif *priv;
+	struct xradio_tx_desc tx_desc[XRADIO_MAX_TID];
+	struct ieee80211_key_conf *ptk;	/* pairwise key, for mc_to_uc */
 };
 enum xradio_data_filterid {
 	IPV4ADDR_FILTER_ID = 0,
@@ -669,6 +820,11 @@ static inline int xrwl_get_nr_hw_ifaces(struct xradio_common *hw_priv)
 /*******************************************************
  interfaces for operations of queue.
 ********************************************************/
+static inline int xradio_hw_queue(int if_id, int queue_id)
+{
+	return if_id * AC_QUEUE_NUM + queue_id;
+}
+
 static inline void xradio_tx_queues_lock(struct xradio_common *hw_priv)
 {
 	int i;